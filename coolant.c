@@ -37,10 +37,67 @@
 #include "grbl/nvs_buffer.h"
 #endif
 
+#include "coolant.h"
+#if LASER_JOB_SUMMARY
+#include "laser_job.h"
+#endif
+#if LASER_TELEMETRY
+#include "laser_telemetry.h"
+#endif
+
+#define COOLANT_POLL_INTERVAL 250 // ms
+#define COOLANT_FLOW_WINDOW 4     // number of poll intervals flow rate is averaged over
+
+#ifndef LASER_COOLANT_ZONES
+#define LASER_COOLANT_ZONES 1 // Number of monitored coolant loops, max 4. Zone 0 is the tube coolant.
+#endif
+
+#if LASER_COOLANT_ZONES > 4
+#error "Max 4 laser coolant zones supported!"
+#endif
+
+#ifndef LASER_COOLANT_HISTORY
+#define LASER_COOLANT_HISTORY 0 // Number of one second samples to keep in the history log, 3600 for the last hour.
+#endif
+
+#define N_EXTRA_ZONES (LASER_COOLANT_ZONES - 1)
+
+typedef union {
+    uint8_t value;
+    struct {
+        uint8_t ok_input   :1,
+                temp_input :1,
+                unassigned :6;
+    };
+} coolant_zone_options_t;
+
+typedef struct {
+    coolant_zone_options_t options;
+    uint8_t ok_port;
+    uint8_t temp_port;
+    uint8_t filter_samples;
+    float max_temp;
+} coolant_zone_settings_t;
+
+typedef struct {
+    bool ok;
+    bool ok_claimed;
+    bool temp_claimed;
+    uint8_t ok_port;
+    uint8_t temp_port;
+    uint_fast8_t low_count;
+    float temp;
+} coolant_zone_t;
+
 typedef union {
     uint8_t value;
     struct {
-        uint8_t enable : 1;
+        uint8_t enable        :1,
+                hold_on_fault :1,
+                prestart      :1,
+                adaptive_off  :1,
+                flow_meter    :1,
+                unassigned    :3;
     };
 } coolant_options_t;
 
@@ -50,60 +107,485 @@ typedef struct {
     float max_temp;
     float on_delay;
     float off_delay;
+    float resume_delay;
+    float fault_timeout;
+    float warm_time;
+    float full_load_time;
+    float flow_pulses;      // pulses per litre
+    float min_flow;         // litres/min
+    float forecast_time;    // seconds
+    uint8_t min_power;      // percent
     uint8_t coolant_ok_port;
     uint8_t coolant_temp_port;
+    uint8_t filter_time;    // ms
+    uint8_t filter_samples;
+#if N_EXTRA_ZONES
+    coolant_zone_settings_t zone[N_EXTRA_ZONES];
+#endif
 } laser_coolant_settings_t;
 
+typedef struct {
+    volatile bool active;
+    bool ok;
+    bool laser_off;     // spindle stop override initiated by the plugin
+    uint32_t lost_at;
+    uint32_t ok_since;
+} coolant_fault_t;
+
+typedef struct {
+    bool laser_on;
+    bool temp_valid;
+    float power;    // programmed laser power, fraction of max
+    float load;     // laser on time at full power in seconds
+    float temp;
+    float trend;    // degrees/minute, filtered
+} coolant_thermal_t;
+
+// First order thermal model of the coolant loop, dT = a * power + b * T + c per second,
+// identified online by recursive least squares.
+typedef struct {
+    bool valid;
+    uint_fast8_t tick;
+    uint_fast8_t derate;    // number of spindle override steps taken
+    uint_fast8_t override;  // spindle override value expected after the last step taken
+    float prev_temp;
+    float prev_power;
+    float theta[3];         // a, b, c
+    float p[3][3];
+    float temp_ss;          // forecast steady state temperature
+    float eta;              // forecast time to max temperature in seconds, 0 if not reached
+} coolant_model_t;
+
+typedef struct {
+    volatile uint32_t pulses;
+    uint32_t pulses_prev;
+    uint32_t sampled_at;
+    uint32_t check_at;      // flow rate is not checked before this time
+    uint_fast8_t idx;
+    uint32_t count[COOLANT_FLOW_WINDOW];
+    uint32_t time[COOLANT_FLOW_WINDOW];
+    float lpm;
+} coolant_flow_t;
+
+#if LASER_COOLANT_HISTORY
+
+#define HISTORY_FLAG_OK       0x01
+#define HISTORY_FLAG_ON       0x02
+#define HISTORY_FLAG_FAULT    0x04
+#define HISTORY_FLAG_LASER_ON 0x08
+
+typedef struct {
+    int16_t temp;   // 0.1 degrees
+    uint16_t flow;  // 0.01 litres/min
+    uint8_t flags;
+    uint8_t power;  // programmed laser power, percent
+} __attribute__((packed)) coolant_sample_t;
+
+typedef struct {
+    uint_fast16_t head;
+    uint_fast16_t count;
+    uint_fast8_t tick;
+    coolant_sample_t sample[LASER_COOLANT_HISTORY];
+} coolant_history_t;
+
+#endif
+
+typedef struct {
+    volatile bool armed;
+    uint_fast8_t samples;
+    uint32_t interval;
+} coolant_filter_t;
+
 static uint8_t coolant_ok_port, coolant_temp_port;
-static bool coolant_on = false, monitor_on = false, can_monitor = false, coolant_off_pending = false;
+static bool coolant_on = false, monitor_on = false, can_monitor = false, coolant_off_pending = false, coolant_prestarted = false;
+static uint32_t prestart_at, ok_seen_at;
+static bool ok_seen = false;
 static on_report_options_ptr on_report_options;
+static on_state_change_ptr on_state_change;
+static on_stream_changed_ptr on_stream_changed;
+static on_spindle_programmed_ptr on_spindle_programmed;
 static on_realtime_report_ptr on_realtime_report;
+static on_program_completed_ptr on_program_completed;
+static on_reset_ptr on_reset;
 static coolant_ptrs_t on_coolant_changed;
+#if LASER_JOB_SUMMARY
+static laser_job_start_ptr on_job_start;
+static laser_job_report_ptr on_job_report;
+static struct {
+    float max_temp;
+    uint32_t derate_time;   // ms
+} coolant_job;
+#endif
 static nvs_address_t nvs_address;
 static laser_coolant_settings_t coolant_settings;
 static uint8_t n_ain, n_din;
 static char max_aport[4], max_dport[4];
+static coolant_fault_t fault = {0};
+static coolant_filter_t filter = {0};
+static coolant_thermal_t thermal = {0};
+static coolant_flow_t flow = {0};
+static coolant_model_t model = {0};
+#if LASER_COOLANT_HISTORY
+static coolant_history_t history = {0};
+#endif
+#if N_EXTRA_ZONES
+static bool zone_monitor_on = false;
+static coolant_zone_t zone[N_EXTRA_ZONES] = {0};
+static const char *zone_ok_name[] = { "Coolant ok zone 1", "Coolant ok zone 2", "Coolant ok zone 3" };
+static const char *zone_temp_name[] = { "Coolant temperature zone 1", "Coolant temperature zone 2", "Coolant temperature zone 3" };
+#endif
 
-static void coolant_lost_handler (uint8_t port, bool state)
+#define COOLANT_FAULT_POLL_INTERVAL 10 // ms
+
+static void coolant_flow_pulse (uint8_t port, bool state)
+{
+    flow.pulses++;
+}
+
+// Updates the flow rate from the pulses counted over the last COOLANT_FLOW_WINDOW samples.
+static void coolant_flow_update (void)
+{
+    uint_fast8_t idx = COOLANT_FLOW_WINDOW;
+    uint32_t ms = hal.get_elapsed_ticks(), pulses = flow.pulses, count = 0, time = 0;
+
+    flow.count[flow.idx] = pulses - flow.pulses_prev;
+    flow.time[flow.idx] = ms - flow.sampled_at;
+    flow.pulses_prev = pulses;
+    flow.sampled_at = ms;
+
+    if(++flow.idx == COOLANT_FLOW_WINDOW)
+        flow.idx = 0;
+
+    do {
+        idx--;
+        count += flow.count[idx];
+        time += flow.time[idx];
+    } while(idx);
+
+    flow.lpm = time && coolant_settings.flow_pulses > 0.0f ? (float)count * 60000.0f / ((float)time * coolant_settings.flow_pulses) : 0.0f;
+}
+
+static bool coolant_ok_get (void)
+{
+    return coolant_settings.options.flow_meter
+            ? flow.lpm >= coolant_settings.min_flow
+            : hal.port.wait_on_input(Port_Digital, coolant_ok_port, WaitMode_Immediate, 0.0f) == 1;
+}
+
+static bool coolant_zones_ok (void)
+{
+    bool ok = true;
+
+#if N_EXTRA_ZONES
+    uint_fast8_t idx = N_EXTRA_ZONES;
+
+    do {
+        idx--;
+        ok &= !zone[idx].ok_claimed || zone[idx].ok;
+    } while(idx);
+#endif
+
+    return ok;
+}
+
+// Reads the zone coolant ok inputs without filtering, used when coolant is turned on.
+static bool coolant_zones_read (void)
+{
+#if N_EXTRA_ZONES
+    uint_fast8_t idx = N_EXTRA_ZONES;
+
+    do {
+        idx--;
+        if(zone[idx].ok_claimed && (zone[idx].ok = hal.port.wait_on_input(Port_Digital, zone[idx].ok_port, WaitMode_Immediate, 0.0f) == 1))
+            zone[idx].low_count = 0;
+    } while(idx);
+#endif
+
+    return coolant_zones_ok();
+}
+
+// Wait for coolant ok signal or minimum flow rate and the zone coolant ok signals, returns false on timeout.
+static bool coolant_ok_wait (float timeout)
+{
+    bool ok;
+
+    if(coolant_settings.options.flow_meter || !coolant_zones_read()) {
+
+        uint32_t ms = hal.get_elapsed_ticks(), started = ms;
+
+        while(!(ok = coolant_ok_get() && coolant_zones_read()) && ms - started < (uint32_t)(timeout * 1000.0f)) {
+            if(coolant_settings.options.flow_meter && ms - flow.sampled_at >= COOLANT_POLL_INTERVAL)
+                coolant_flow_update();
+            if(!protocol_execute_realtime())
+                break;
+            ms = hal.get_elapsed_ticks();
+        }
+    } else
+        ok = hal.port.wait_on_input(Port_Digital, coolant_ok_port, WaitMode_High, timeout) == 1;
+
+    return ok;
+}
+
+// Runs while a coolant fault holds the machine. Resumes the cycle when the coolant ok
+// signal has been stable for the configured time, raises an alarm on timeout.
+// The fault stays latched until coolant is restored or turned off, a cycle started
+// while it is latched is held again.
+static void coolant_fault_monitor (void *data)
+{
+    uint32_t ms = hal.get_elapsed_ticks();
+    sys_state_t state = state_get();
+
+    if(!fault.active)
+        return;
+
+    if(!coolant_on) {
+        fault.active = false;
+        return;
+    }
+
+    if(coolant_ok_get() && coolant_zones_ok()) {
+        if(!fault.ok) {
+            fault.ok = true;
+            fault.ok_since = ms;
+        }
+    } else {
+        fault.ok = false;
+        if(state == STATE_CYCLE) { // Cycle restarted by the user, hold again.
+            fault.laser_off = false;
+            system_set_exec_state_flag(EXEC_FEED_HOLD);
+        }
+    }
+
+    // The core only turns the laser off in a hold when configured to do so ($63),
+    // stop it explicitly. It is restored by the core on cycle start.
+    if(state == STATE_HOLD && sys.holding_state == Hold_Complete && !fault.laser_off) {
+        fault.laser_off = true;
+        if(!sys.override.spindle_stop.value)
+            grbl.enqueue_realtime_command(CMD_OVERRIDE_SPINDLE_STOP);
+    }
+
+    if(fault.ok && ms - fault.ok_since >= (uint32_t)(coolant_settings.resume_delay * 1000.0f)) {
+        if(state == STATE_HOLD && sys.holding_state == Hold_Complete) {
+            fault.active = false;
+            report_message("Laser coolant restored, resuming", Message_Info);
+            system_set_exec_state_flag(EXEC_CYCLE_START);
+            return;
+        }
+        if(!(state & (STATE_HOLD|STATE_CYCLE))) {
+            fault.active = false;
+            report_message("Laser coolant restored", Message_Info);
+            return;
+        }
+    } else if(coolant_settings.fault_timeout > 0.0f && ms - fault.lost_at >= (uint32_t)(coolant_settings.fault_timeout * 1000.0f)) {
+        fault.active = false;
+        system_set_exec_alarm(Alarm_AbortCycle);
+        return;
+    }
+
+    task_add_delayed(coolant_fault_monitor, NULL, COOLANT_FAULT_POLL_INTERVAL);
+}
+
+static void coolant_fault_start (void *data)
 {
-    if(coolant_on && !coolant_off_pending)
+    report_message("Laser coolant lost, holding", Message_Warning);
+
+    task_add_delayed(coolant_fault_monitor, NULL, COOLANT_FAULT_POLL_INTERVAL);
+}
+
+// May be called from interrupt context. Faults outside of a cycle raise an alarm as there is no job to hold.
+static void coolant_fault_raise (void)
+{
+    if(!coolant_settings.options.hold_on_fault || !(state_get() & (STATE_HOLD|STATE_CYCLE)))
         system_set_exec_alarm(Alarm_AbortCycle);
+    else if(!fault.active) {
+        fault.active = true;
+        fault.ok = fault.laser_off = false;
+        fault.lost_at = hal.get_elapsed_ticks();
+        system_set_exec_state_flag(EXEC_FEED_HOLD);
+        protocol_enqueue_foreground_task(coolant_fault_start, NULL);
+    }
+}
+
+// Glitch filter, samples the coolant ok input at regular intervals after a falling edge
+// and raises the fault only if it stays low for all samples.
+static void coolant_filter_sample (void *data)
+{
+    if(!filter.armed)
+        return;
+
+    if(hal.port.wait_on_input(Port_Digital, coolant_ok_port, WaitMode_Immediate, 0.0f) == 1)
+        filter.armed = false;
+    else if(--filter.samples == 0) {
+        filter.armed = false;
+        if(coolant_on && !coolant_off_pending)
+            coolant_fault_raise();
+    } else
+        task_add_delayed(coolant_filter_sample, NULL, filter.interval);
+}
+
+static void coolant_filter_start (void *data)
+{
+    filter.samples = coolant_settings.filter_samples ? coolant_settings.filter_samples : 1;
+    if((filter.interval = coolant_settings.filter_time / filter.samples) == 0)
+        filter.interval = 1;
+
+    task_add_delayed(coolant_filter_sample, NULL, filter.interval);
+}
+
+static void coolant_lost_handler (uint8_t port, bool state)
+{
+    if(coolant_on && !coolant_off_pending) {
+        if(coolant_settings.filter_time == 0)
+            coolant_fault_raise();
+        else if(!filter.armed) {
+            filter.armed = true;
+            protocol_enqueue_foreground_task(coolant_filter_start, NULL);
+        }
+    }
+}
+
+// Records when the coolant loop was last seen flowing: coolant is on and the ok input is high
+// with no falling edge being filtered, or the flow rate averaged after coolant was turned on is sufficient.
+static void coolant_ok_seen (void)
+{
+    uint32_t ms = hal.get_elapsed_ticks();
+
+    if(on_coolant_changed.get_state().flood && !fault.active &&
+        (coolant_settings.options.flow_meter
+          ? (int32_t)(ms - flow.check_at) >= 0 && flow.lpm >= coolant_settings.min_flow
+          : !filter.armed && coolant_ok_get())) {
+        ok_seen = true;
+        ok_seen_at = ms;
+    }
+}
+
+// Flow meter pulses are counted on rising edges, a coolant fault is raised on falling edges of the coolant ok input.
+static bool coolant_irq_register (void)
+{
+    xbar_t *port;
+    pin_irq_mode_t irq_mode = coolant_settings.options.flow_meter ? IRQ_Mode_Rising : IRQ_Mode_Falling;
+
+    return hal.port.get_pin_info &&
+            (port = hal.port.get_pin_info(Port_Digital, Port_Input, coolant_ok_port)) &&
+             (port->cap.irq_mode & irq_mode) &&
+              hal.port.register_interrupt_handler(coolant_ok_port, irq_mode, coolant_settings.options.flow_meter ? coolant_flow_pulse : coolant_lost_handler);
+}
+
+// Returns true if the coolant loop was flowing within the configured warm time.
+static bool coolant_is_warm (void)
+{
+    return coolant_settings.warm_time > 0.0f && ok_seen &&
+            (hal.get_elapsed_ticks() - ok_seen_at) <= (uint32_t)(coolant_settings.warm_time * 1000.0f);
+}
+
+// Deferred check of the coolant ok signal when motion was not held by the on delay.
+static void coolant_ok_verify (void *data)
+{
+    if(coolant_on && !coolant_off_pending && !(coolant_ok_get() && coolant_zones_read()))
+        coolant_fault_raise();
 }
 
 static void coolant_flood_off (void *data)
 {
     coolant_state_t mode = hal.coolant.get_state();
+
+    task_delete(coolant_ok_verify, NULL);
+
     mode.flood = Off;
     on_coolant_changed.set_state(mode);
-    coolant_off_pending = coolant_on = false;
+    coolant_off_pending = coolant_on = coolant_prestarted = fault.active = false;
     sys.report.coolant = On; // Set to report change immediately
 }
 
+// Off delay in ms, scaled by the thermal load since coolant was turned on if adaptive
+// mode is enabled. The full delay is used while the coolant temperature is rising.
+static uint32_t coolant_get_off_delay (void)
+{
+    float delay = coolant_settings.off_delay;
+
+    if(coolant_settings.options.adaptive_off && coolant_settings.full_load_time > 0.0f && !(thermal.temp_valid && thermal.trend > 0.1f))
+        delay *= max(0.1f, min(1.0f, thermal.load / (coolant_settings.full_load_time * 60.0f)));
+
+    return (uint32_t)(delay * 60.0f * 1000.0f);
+}
+
+// Start tube coolant ahead of M8 so that the on delay overlaps homing, framing etc.
+static void coolant_prestart (void)
+{
+    coolant_state_t mode = hal.coolant.get_state();
+
+    if(!mode.flood) {
+        mode.flood = On;
+        on_coolant_changed.set_state(mode);
+        coolant_prestarted = true;
+        prestart_at = hal.get_elapsed_ticks();
+        sys.report.coolant = On; // Set to report change immediately
+    }
+}
+
+// Stop pre-started coolant if M8 did not follow.
+static void coolant_prestart_expire (void *data)
+{
+    if(coolant_prestarted)
+        coolant_flood_off(NULL);
+}
+
 // Start/stop tube coolant, wait for ok signal on start if delay is configured.
 static void coolantSetState (coolant_state_t mode)
 {
-    static bool irq_checked = false;
-
-    bool changed = mode.flood != hal.coolant.get_state().flood || (mode.flood && coolant_off_pending);
+    bool changed = mode.flood != hal.coolant.get_state().flood || (mode.flood && (coolant_off_pending || coolant_prestarted));
 
     if(changed && !mode.flood) {
 
+        coolant_prestarted = false;
+        task_delete(coolant_prestart_expire, NULL);
+
         if(coolant_settings.off_delay > 0.0f && !sys.reset_pending) {
             mode.flood = On;
-            coolant_off_pending = task_add_delayed(coolant_flood_off, NULL, (uint32_t)(coolant_settings.off_delay * 60.0f * 1000.0f));
+            coolant_off_pending = task_add_delayed(coolant_flood_off, NULL, coolant_get_off_delay());
             on_coolant_changed.set_state(mode);
             return;
         }
 
-        coolant_on = false;
+        task_delete(coolant_ok_verify, NULL);
+        coolant_on = fault.active = false;
     }
 
     on_coolant_changed.set_state(mode);
 
     if(changed && mode.flood) {
+
+        float on_delay = coolant_settings.on_delay;
+
+        if(!(coolant_off_pending || coolant_prestarted))
+            thermal.load = 0.0f;
+
         task_delete(coolant_flood_off, NULL);
         coolant_off_pending = false;
-        if(coolant_settings.on_delay > 0.0f && hal.port.wait_on_input(Port_Digital, coolant_ok_port, WaitMode_High, coolant_settings.on_delay) != 1) {
+
+        if(coolant_prestarted) {
+            // Only wait for what is left of the on delay since coolant was pre-started.
+            task_delete(coolant_prestart_expire, NULL);
+            coolant_prestarted = false;
+            on_delay -= (float)(hal.get_elapsed_ticks() - prestart_at) / 1000.0f;
+            if(on_delay <= 0.0f && coolant_settings.on_delay > 0.0f)
+                on_delay = 0.001f;
+        }
+
+        // Flow rate is checked by the poll when the on delay, or the deferred verify, has passed
+        // and the flow rate has been averaged over samples taken after coolant was turned on.
+        flow.check_at = hal.get_elapsed_ticks() + COOLANT_FLOW_WINDOW * COOLANT_POLL_INTERVAL;
+
+        if(on_delay > 0.0f && coolant_is_warm()) {
+            // The loop was flowing recently, do not hold motion waiting for the ok signal.
+            // It is verified when the on delay has expired instead.
+            if(!(coolant_ok_get() && coolant_zones_read()))
+                task_add_delayed(coolant_ok_verify, NULL, (uint32_t)(on_delay * 1000.0f));
+            flow.check_at += (uint32_t)(on_delay * 1000.0f);
+            on_delay = 0.0f;
+        }
+
+        if(on_delay > 0.0f && !coolant_ok_wait(on_delay)) {
             mode.flood = Off;
             coolant_on = false;
             on_coolant_changed.set_state(mode);
@@ -112,38 +594,384 @@ static void coolantSetState (coolant_state_t mode)
             coolant_on = true;
     }
 
-    if(!irq_checked) {
+    monitor_on = mode.flood && (coolant_settings.min_temp + coolant_settings.max_temp) > 0.0f;
+#if N_EXTRA_ZONES
+    zone_monitor_on = mode.flood; // Zones are checked against their own max temperature.
+#endif
+}
+
+#if LASER_COOLANT_HISTORY
+
+static void coolant_history_add (void)
+{
+    coolant_sample_t *sample = &history.sample[history.head];
+
+    sample->temp = (int16_t)lroundf(thermal.temp * 10.0f);
+    sample->flow = (uint16_t)lroundf(min(flow.lpm, 655.0f) * 100.0f);
+    sample->power = (uint8_t)lroundf(thermal.power * 100.0f);
+    sample->flags = (coolant_ok_get() && coolant_zones_ok() ? HISTORY_FLAG_OK : 0) |
+                     (coolant_on ? HISTORY_FLAG_ON : 0) |
+                      (fault.active ? HISTORY_FLAG_FAULT : 0) |
+                       (thermal.laser_on ? HISTORY_FLAG_LASER_ON : 0);
 
-        irq_checked = true;
+    if(++history.head == LASER_COOLANT_HISTORY)
+        history.head = 0;
 
-        if(hal.port.get_pin_info) {
-            xbar_t *port = hal.port.get_pin_info(Port_Digital, Port_Input, coolant_ok_port);
-            if(port && (port->cap.irq_mode & IRQ_Mode_Falling))
-                hal.port.register_interrupt_handler(coolant_ok_port, IRQ_Mode_Falling, coolant_lost_handler);
+    if(history.count < LASER_COOLANT_HISTORY)
+        history.count++;
+}
+
+// $LCH - dump history as CSV, oldest sample first. Time is in seconds relative to the last sample.
+// $LCH=B - dump history in binary format: "LCH", version, uint16_t sample count followed by
+//          the samples as packed little endian coolant_sample_t structs.
+static status_code_t coolant_history_dump (sys_state_t state, char *args)
+{
+    uint_fast16_t idx = history.count, tail = (history.head + LASER_COOLANT_HISTORY - history.count) % LASER_COOLANT_HISTORY;
+
+    if(args && *args) {
+
+        uint8_t header[6] = { 'L', 'C', 'H', 1, (uint8_t)(history.count & 0xFF), (uint8_t)(history.count >> 8) };
+
+        if(!((*args == 'B' || *args == 'b') && args[1] == '\0' && hal.stream.write_n))
+            return Status_InvalidStatement;
+
+        hal.stream.write_n(header, sizeof(header));
+
+        if(tail + history.count > LASER_COOLANT_HISTORY) {
+            hal.stream.write_n((uint8_t *)&history.sample[tail], (LASER_COOLANT_HISTORY - tail) * sizeof(coolant_sample_t));
+            hal.stream.write_n((uint8_t *)history.sample, history.head * sizeof(coolant_sample_t));
+        } else
+            hal.stream.write_n((uint8_t *)&history.sample[tail], history.count * sizeof(coolant_sample_t));
+
+    } else {
+
+        coolant_sample_t *sample;
+
+        hal.stream.write("time,temp,flow,power,ok,on,fault,laser" ASCII_EOL);
+
+        while(idx) {
+            sample = &history.sample[tail];
+            hal.stream.write("-");
+            hal.stream.write(uitoa(--idx));
+            hal.stream.write(",");
+            hal.stream.write(ftoa((float)sample->temp / 10.0f, 1));
+            hal.stream.write(",");
+            hal.stream.write(ftoa((float)sample->flow / 100.0f, 2));
+            hal.stream.write(",");
+            hal.stream.write(uitoa(sample->power));
+            hal.stream.write(sample->flags & HISTORY_FLAG_OK ? ",1" : ",0");
+            hal.stream.write(sample->flags & HISTORY_FLAG_ON ? ",1" : ",0");
+            hal.stream.write(sample->flags & HISTORY_FLAG_FAULT ? ",1" : ",0");
+            hal.stream.write(sample->flags & HISTORY_FLAG_LASER_ON ? ",1" ASCII_EOL : ",0" ASCII_EOL);
+            if(++tail == LASER_COOLANT_HISTORY)
+                tail = 0;
         }
     }
 
-    monitor_on = mode.flood && (coolant_settings.min_temp + coolant_settings.max_temp) > 0.0f;
+    return Status_OK;
 }
 
-static void onRealtimeReport (stream_write_ptr stream_write, report_tracking_flags_t report)
+static const sys_command_t history_command_list[] = {
+    {"LCH", coolant_history_dump, { .allow_blocking = On }, { .str = "dump laser coolant history, $LCH=B for binary format" } }
+};
+
+static sys_commands_t history_commands = {
+    .n_commands = sizeof(history_command_list) / sizeof(sys_command_t),
+    .commands = history_command_list
+};
+
+#endif // LASER_COOLANT_HISTORY
+
+#define MODEL_FORGETTING_FACTOR 0.995f
+#define MODEL_P_MAX 3000.0f // max trace of the covariance matrix, the initial value
+
+static void coolant_model_reset (void)
+{
+    memset(&model, 0, sizeof(coolant_model_t));
+    model.p[0][0] = model.p[1][1] = model.p[2][2] = 1000.0f;
+}
+
+// Called once per second. Updates the model and forecasts when max temperature will be
+// reached at the current laser power, steps power down via the spindle override if
+// that is within the forecast time and back up when clear. Steps are only taken back
+// if the override has not been changed by the user in the meantime.
+static void coolant_model_update (void)
 {
-    static float coolant_temp_prev = 0.0f;
+    uint_fast8_t i, j;
+    float power = thermal.laser_on && state_get() == STATE_CYCLE ? thermal.power : 0.0f;
 
-    char buf[20] = "";
+    if(model.valid) {
+
+        float phi[3] = { model.prev_power, model.prev_temp, 1.0f }, pphi[3], k[3], denom = MODEL_FORGETTING_FACTOR, err = thermal.temp - model.prev_temp, trace;
+
+        for(i = 0; i < 3; i++) {
+            pphi[i] = model.p[i][0] * phi[0] + model.p[i][1] * phi[1] + model.p[i][2] * phi[2];
+            denom += phi[i] * pphi[i];
+            err -= phi[i] * model.theta[i];
+        }
+
+        for(i = 0; i < 3; i++) {
+            k[i] = pphi[i] / denom;
+            model.theta[i] += k[i] * err;
+        }
 
+        // P is symmetric so phi' * P == (P * phi)'
+        for(i = 0; i < 3; i++) {
+            for(j = 0; j < 3; j++)
+                model.p[i][j] = (model.p[i][j] - k[i] * pphi[j]) / MODEL_FORGETTING_FACTOR;
+        }
+
+        // P grows without bound when the input does not change, e.g. while idle. Scale it
+        // down so the model does not overreact to the first samples when the laser is turned on.
+        if((trace = model.p[0][0] + model.p[1][1] + model.p[2][2]) > MODEL_P_MAX) {
+            for(i = 0; i < 3; i++) {
+                for(j = 0; j < 3; j++)
+                    model.p[i][j] *= MODEL_P_MAX / trace;
+            }
+        }
+    }
+
+    model.valid = true;
+    model.prev_temp = thermal.temp;
+    model.prev_power = power;
+
+    if(model.theta[1] < 0.0f) {
+        model.temp_ss = -(model.theta[0] * power + model.theta[2]) / model.theta[1];
+        model.eta = model.temp_ss > coolant_settings.max_temp && thermal.temp < coolant_settings.max_temp
+                     ? logf((model.temp_ss - thermal.temp) / (model.temp_ss - coolant_settings.max_temp)) / -model.theta[1]
+                     : 0.0f;
+    } else {
+        float slope = model.theta[0] * power + model.theta[1] * thermal.temp + model.theta[2];
+        model.temp_ss = thermal.temp;
+        model.eta = slope > 0.0f && thermal.temp < coolant_settings.max_temp ? (coolant_settings.max_temp - thermal.temp) / slope : 0.0f;
+    }
+
+    if(model.derate && sys.override.spindle_rpm != model.override)
+        model.derate = 0;
+
+    if(monitor_on && model.eta > 0.0f && model.eta < coolant_settings.forecast_time) {
+        if(state_get() == STATE_CYCLE && sys.override.spindle_rpm > max(coolant_settings.min_power, 1)) {
+            model.derate++;
+            model.override = sys.override.spindle_rpm - 1;
+            grbl.enqueue_realtime_command(CMD_OVERRIDE_SPINDLE_FINE_MINUS);
+        }
+    } else if(model.derate && (model.eta == 0.0f || model.eta > coolant_settings.forecast_time * 2.0f)) {
+        model.derate--;
+        model.override = sys.override.spindle_rpm + 1;
+        grbl.enqueue_realtime_command(CMD_OVERRIDE_SPINDLE_FINE_PLUS);
+    }
+}
+
+// Samples coolant temperature and flow rate, accumulates the thermal load.
+static void coolant_poll (void *data)
+{
     if(can_monitor) {
 
-        float coolant_temp = (float)hal.port.wait_on_input(Port_Analog, coolant_temp_port, WaitMode_Immediate, 0.0f) / 10.0f;
+        float temp = (float)hal.port.wait_on_input(Port_Analog, coolant_temp_port, WaitMode_Immediate, 0.0f) / 10.0f;
+
+        if(thermal.temp_valid)
+            thermal.trend += ((temp - thermal.temp) * (60000.0f / (float)COOLANT_POLL_INTERVAL) - thermal.trend) * 0.02f;
+
+        thermal.temp = temp;
+        thermal.temp_valid = true;
+
+#if LASER_JOB_SUMMARY
+        if(temp > coolant_job.max_temp)
+            coolant_job.max_temp = temp;
+#endif
+
+        if(monitor_on && temp > coolant_settings.max_temp)
+            system_set_exec_alarm(Alarm_AbortCycle);
+    }
+
+#if N_EXTRA_ZONES
+
+    uint_fast8_t idx = N_EXTRA_ZONES;
+    coolant_zone_t *z;
+
+    // Batched pass over the additional zones, ok inputs are filtered by requiring
+    // the configured number of consecutive low samples. A fault is raised whenever
+    // coolant is on and a zone is not ok, also if it was not ok when coolant was turned on.
+    do {
+        z = &zone[--idx];
+        if(z->temp_claimed) {
+            z->temp = (float)hal.port.wait_on_input(Port_Analog, z->temp_port, WaitMode_Immediate, 0.0f) / 10.0f;
+            if(zone_monitor_on && coolant_settings.zone[idx].max_temp > 0.0f && z->temp > coolant_settings.zone[idx].max_temp)
+                system_set_exec_alarm(Alarm_AbortCycle);
+        }
+        if(z->ok_claimed) {
+            if(hal.port.wait_on_input(Port_Digital, z->ok_port, WaitMode_Immediate, 0.0f) == 1) {
+                z->ok = true;
+                z->low_count = 0;
+            } else if(++z->low_count >= coolant_settings.zone[idx].filter_samples) {
+                z->low_count = coolant_settings.zone[idx].filter_samples;
+                z->ok = false;
+            }
+        }
+    } while(idx);
+
+    if(coolant_on && !coolant_off_pending && !fault.active && !coolant_zones_ok())
+        coolant_fault_raise();
+
+#endif
+
+    if(coolant_settings.options.flow_meter) {
+
+        coolant_flow_update();
+
+        if(coolant_on && !coolant_off_pending && flow.lpm < coolant_settings.min_flow && !fault.active &&
+            (int32_t)(hal.get_elapsed_ticks() - flow.check_at) >= 0)
+            coolant_fault_raise();
+    }
+
+    coolant_ok_seen();
+
+    if(coolant_on && thermal.laser_on && state_get() == STATE_CYCLE)
+        thermal.load += thermal.power * ((float)COOLANT_POLL_INTERVAL / 1000.0f);
+
+    if(can_monitor && coolant_settings.forecast_time > 0.0f && ++model.tick == 1000 / COOLANT_POLL_INTERVAL) {
+        model.tick = 0;
+        coolant_model_update();
+    }
+
+#if LASER_JOB_SUMMARY
+    if(model.derate)
+        coolant_job.derate_time += COOLANT_POLL_INTERVAL;
+#endif
+
+#if LASER_COOLANT_HISTORY
+    if(++history.tick == 1000 / COOLANT_POLL_INTERVAL) {
+        history.tick = 0;
+        coolant_history_add();
+    }
+#endif
+
+    task_add_delayed(coolant_poll, NULL, COOLANT_POLL_INTERVAL);
+}
+
+static void onSpindleProgrammed (spindle_ptrs_t *spindle, spindle_state_t state, float rpm, spindle_rpm_mode_t mode)
+{
+    thermal.laser_on = state.on && spindle->cap.laser;
+    thermal.power = settings.spindle.rpm_max > 0.0f ? min(rpm / settings.spindle.rpm_max, 1.0f) : 1.0f;
+
+    if(on_spindle_programmed)
+        on_spindle_programmed(spindle, state, rpm, mode);
+}
+
+// Steps taken by the thermal forecast are not carried over to the next job.
+static void onProgramCompleted (program_flow_t program_flow, bool check_mode)
+{
+    model.derate = 0;
+
+    if(on_program_completed)
+        on_program_completed(program_flow, check_mode);
+}
+
+static void onReset (void)
+{
+    model.derate = 0;
+
+    if(on_reset)
+        on_reset();
+}
+
+static void onStateChanged (sys_state_t state)
+{
+    if(coolant_settings.options.prestart) {
+        if(state & (STATE_HOMING|STATE_CYCLE)) {
+            if(coolant_prestarted)
+                task_delete(coolant_prestart_expire, NULL);
+            else
+                coolant_prestart();
+        } else if(state == STATE_IDLE && coolant_prestarted) {
+            task_delete(coolant_prestart_expire, NULL);
+            task_add_delayed(coolant_prestart_expire, NULL, (uint32_t)(max(coolant_settings.off_delay, 1.0f) * 60.0f * 1000.0f));
+        }
+    }
+
+    if(on_state_change)
+        on_state_change(state);
+}
 
-        if(coolant_temp_prev != coolant_temp || report.all) {
+static void onStreamChanged (stream_type_t type)
+{
+    if(on_stream_changed)
+        on_stream_changed(type);
+
+    if(type == StreamType_File && coolant_settings.options.prestart)
+        coolant_prestart();
+}
+
+static void onRealtimeReport (stream_write_ptr stream_write, report_tracking_flags_t report)
+{
+    static float coolant_temp_prev = 0.0f, coolant_flow_prev = 0.0f;
+
+    char buf[48] = "";
+
+    if(can_monitor && thermal.temp_valid) {
+        if(coolant_temp_prev != thermal.temp || report.all) {
             strcat(buf, "|TCT:");
-            strcat(buf, ftoa(coolant_temp, 1));
-            coolant_temp_prev = coolant_temp;
+            strcat(buf, ftoa(thermal.temp, 1));
+            coolant_temp_prev = thermal.temp;
         }
 
-        if(monitor_on && coolant_temp > coolant_settings.max_temp)
-            system_set_exec_alarm(Alarm_AbortCycle);
+        if(coolant_settings.forecast_time > 0.0f && model.valid) {
+
+            static float temp_ss_prev = 0.0f, eta_prev = 0.0f;
+
+            float temp_ss = truncf(model.temp_ss * 10.0f) / 10.0f, eta = truncf(model.eta);
+
+            if(temp_ss_prev != temp_ss || eta_prev != eta || report.all) {
+                strcat(buf, "|TCF:");
+                strcat(buf, ftoa(temp_ss, 1));
+                strcat(buf, ",");
+                strcat(buf, uitoa((uint32_t)eta));
+                temp_ss_prev = temp_ss;
+                eta_prev = eta;
+            }
+        }
+    }
+
+#if N_EXTRA_ZONES
+    {
+        static float zone_temp_prev[N_EXTRA_ZONES] = {0};
+
+        bool changed = report.all;
+        uint_fast8_t idx;
+
+        for(idx = 0; idx < N_EXTRA_ZONES; idx++) {
+            if(zone[idx].temp_claimed && zone_temp_prev[idx] != zone[idx].temp) {
+                zone_temp_prev[idx] = zone[idx].temp;
+                changed = true;
+            }
+        }
+
+        if(changed) {
+            char *sep = "|TCZ:";
+            if(*buf != '\0') {
+                stream_write(buf);
+                *buf = '\0';
+            }
+            for(idx = 0; idx < N_EXTRA_ZONES; idx++) {
+                if(zone[idx].temp_claimed) {
+                    stream_write(sep);
+                    stream_write(ftoa(zone[idx].temp, 1));
+                    sep = ",";
+                }
+            }
+        }
+    }
+#endif
+
+    if(coolant_settings.options.flow_meter) {
+
+        float lpm = truncf(flow.lpm * 10.0f) / 10.0f;
+
+        if(coolant_flow_prev != lpm || report.all) {
+            strcat(buf, "|FLW:");
+            strcat(buf, ftoa(lpm, 1));
+            coolant_flow_prev = lpm;
+        }
     }
 
     if(*buf != '\0')
@@ -155,23 +983,72 @@ static void onRealtimeReport (stream_write_ptr stream_write, report_tracking_fla
 
 static bool is_setting_available (const setting_detail_t *setting)
 {
-    return (setting->id == Setting_LaserCoolantMaxTemp || setting->id == Setting_LaserCoolantTempPort) && n_ain > 0;
+    bool available = setting->id == Setting_LaserCoolantMaxTemp || setting->id == Setting_LaserCoolantTempPort ||
+                      setting->id == Setting_LaserCoolantForecastTime || setting->id == Setting_LaserCoolantMinPower;
+
+#if N_EXTRA_ZONES
+    if(setting->id > Setting_LaserCoolantZoneBase)
+        available = (setting->id - Setting_LaserCoolantZoneBase) % 10 == 2 || (setting->id - Setting_LaserCoolantZoneBase) % 10 == 4;
+#endif
+
+    return available && n_ain > 0;
 }
 
+#define ZONE_SETTINGS(z) \
+    { ZONE_SETTING_ID(z, 0), Group_Coolant, "Coolant zone " #z " inputs", NULL, Format_Bitfield, "Ok,Temperature", NULL, NULL, Setting_NonCore, &coolant_settings.zone[z - 1].options.value, NULL, NULL, { .reboot_required = On } }, \
+    { ZONE_SETTING_ID(z, 1), Group_AuxPorts, "Coolant zone " #z " ok port", NULL, Format_Int8, "#0", "0", max_dport, Setting_NonCore, &coolant_settings.zone[z - 1].ok_port, NULL, NULL, { .reboot_required = On } }, \
+    { ZONE_SETTING_ID(z, 2), Group_AuxPorts, "Coolant zone " #z " temperature port", NULL, Format_Int8, "#0", "0", max_aport, Setting_NonCore, &coolant_settings.zone[z - 1].temp_port, NULL, is_setting_available, { .reboot_required = On } }, \
+    { ZONE_SETTING_ID(z, 3), Group_Coolant, "Coolant zone " #z " ok filter samples", NULL, Format_Int8, "#0", "1", "20", Setting_NonCore, &coolant_settings.zone[z - 1].filter_samples, NULL, NULL }, \
+    { ZONE_SETTING_ID(z, 4), Group_Coolant, "Coolant zone " #z " max temp", "deg", Format_Decimal, "#0.0", "0.0", "100.0", Setting_NonCore, &coolant_settings.zone[z - 1].max_temp, NULL, is_setting_available }
+
 static const setting_detail_t plugin_settings[] = {
+    { Setting_LaserCoolantOptions, Group_Coolant, "Laser coolant options", NULL, Format_Bitfield, "N/A,Feed hold on coolant fault,Start coolant at program start,Adaptive off delay,Flow meter input", NULL, NULL, Setting_NonCore, &coolant_settings.options.value, NULL, NULL, { .reboot_required = On } },
     { Setting_LaserCoolantOnDelay, Group_Coolant, "Laser coolant on delay", "seconds", Format_Decimal, "#0.0", "0.0", "30.0", Setting_NonCore, &coolant_settings.on_delay, NULL, NULL },
     { Setting_LaserCoolantOffDelay, Group_Coolant, "Laser coolant off delay", "minutes", Format_Decimal, "#0.0", "0.0", "30.0", Setting_NonCore, &coolant_settings.off_delay, NULL, NULL },
 //    { Setting_LaserCoolantMinTemp, Group_Coolant, "Laser coolant min temp", "deg", Format_Decimal, "#0.0", "0.0", "30.0", Setting_NonCore, &coolant_settings.min_temp, NULL, NULL, false },
+    { Setting_LaserCoolantResumeDelay, Group_Coolant, "Laser coolant resume delay", "seconds", Format_Decimal, "#0.0", "0.0", "30.0", Setting_NonCore, &coolant_settings.resume_delay, NULL, NULL },
+    { Setting_LaserCoolantFaultTimeout, Group_Coolant, "Laser coolant fault timeout", "seconds", Format_Decimal, "##0.0", "0.0", "600.0", Setting_NonCore, &coolant_settings.fault_timeout, NULL, NULL },
+    { Setting_LaserCoolantFilterTime, Group_Coolant, "Laser coolant ok filter time", "milliseconds", Format_Int8, "##0", "0", "250", Setting_NonCore, &coolant_settings.filter_time, NULL, NULL },
+    { Setting_LaserCoolantFilterCount, Group_Coolant, "Laser coolant ok filter samples", NULL, Format_Int8, "#0", "1", "20", Setting_NonCore, &coolant_settings.filter_samples, NULL, NULL },
+    { Setting_LaserCoolantWarmTime, Group_Coolant, "Laser coolant warm time", "seconds", Format_Decimal, "###0", "0", "3600", Setting_NonCore, &coolant_settings.warm_time, NULL, NULL },
+    { Setting_LaserCoolantFullLoadTime, Group_Coolant, "Laser coolant full load time", "minutes", Format_Decimal, "##0.0", "0.0", "600.0", Setting_NonCore, &coolant_settings.full_load_time, NULL, NULL },
+    { Setting_LaserCoolantFlowPulses, Group_Coolant, "Laser coolant flow meter pulses", "pulses/l", Format_Decimal, "####0.0", "1.0", "10000.0", Setting_NonCore, &coolant_settings.flow_pulses, NULL, NULL },
+    { Setting_LaserCoolantMinFlow, Group_Coolant, "Laser coolant min flow", "l/min", Format_Decimal, "#0.0", "0.0", "100.0", Setting_NonCore, &coolant_settings.min_flow, NULL, NULL },
+    { Setting_LaserCoolantForecastTime, Group_Coolant, "Laser coolant forecast time", "seconds", Format_Decimal, "##0", "0", "600", Setting_NonCore, &coolant_settings.forecast_time, NULL, is_setting_available },
+    { Setting_LaserCoolantMinPower, Group_Coolant, "Laser coolant min power override", "percent", Format_Int8, "##0", "10", "100", Setting_NonCore, &coolant_settings.min_power, NULL, is_setting_available },
     { Setting_LaserCoolantMaxTemp, Group_Coolant, "Laser coolant max temp", "deg", Format_Decimal, "#0.0", "0.0", "30.0", Setting_NonCore, &coolant_settings.max_temp, NULL, is_setting_available },
     { Setting_LaserCoolantTempPort, Group_AuxPorts, "Coolant temperature port", NULL, Format_Int8, "#0", "0", max_aport, Setting_NonCore, &coolant_settings.coolant_temp_port, NULL, is_setting_available, { .reboot_required = On } },
-    { Setting_LaserCoolantOkPort, Group_AuxPorts, "Coolant ok port", NULL, Format_Int8, "#0", "0", max_dport, Setting_NonCore, &coolant_settings.coolant_ok_port, NULL, NULL, { .reboot_required = On } }
+    { Setting_LaserCoolantOkPort, Group_AuxPorts, "Coolant ok port", NULL, Format_Int8, "#0", "0", max_dport, Setting_NonCore, &coolant_settings.coolant_ok_port, NULL, NULL, { .reboot_required = On } },
+#if N_EXTRA_ZONES > 0
+    ZONE_SETTINGS(1),
+#endif
+#if N_EXTRA_ZONES > 1
+    ZONE_SETTINGS(2),
+#endif
+#if N_EXTRA_ZONES > 2
+    ZONE_SETTINGS(3),
+#endif
 };
 
 #ifndef NO_SETTINGS_DESCRIPTIONS
 
 static const setting_descr_t plugin_settings_descr[] = {
+    { Setting_LaserCoolantOptions, "Feed hold on coolant fault: hold instead of aborting when the coolant ok signal is lost, resume when it is restored.\\n"
+                                   "Start coolant at program start: turn coolant on when a job is started, on homing or on the first motion, to hide the on delay.\\n"
+                                   "Adaptive off delay: scale the off delay by the laser load since coolant was turned on.\\n"
+                                   "Flow meter input: the coolant ok port is a pulse input from a flow meter, the flow rate has to be above the min flow setting for coolant to be ok." },
     { Setting_LaserCoolantOnDelay, "" },
     { Setting_LaserCoolantOffDelay, "" },
+    { Setting_LaserCoolantResumeDelay, "Time the coolant ok signal has to be stable before a held job is resumed." },
+    { Setting_LaserCoolantFaultTimeout, "Time to wait for the coolant ok signal to be restored before the job is aborted.\\n0 to wait indefinitely." },
+    { Setting_LaserCoolantFilterTime, "Time the coolant ok signal has to stay low before a coolant fault is raised, filters out glitches.\\n0 to disable filtering." },
+    { Setting_LaserCoolantFilterCount, "Number of times the coolant ok signal is sampled within the filter time." },
+    { Setting_LaserCoolantWarmTime, "Time after coolant is turned off where M8 does not wait for the coolant ok signal, it is checked when the on delay has expired instead.\\n0 to disable." },
+    { Setting_LaserCoolantFullLoadTime, "Laser on time at full power that results in the full off delay when adaptive off delay is enabled. Shorter or lower power jobs get a proportionally shorter delay, down to 10% of the off delay." },
+    { Setting_LaserCoolantFlowPulses, "Number of pulses per litre output by the flow meter." },
+    { Setting_LaserCoolantMinFlow, "Minimum flow rate, a coolant fault is raised when the flow rate drops below this." },
+    { Setting_LaserCoolantForecastTime, "Laser power is stepped down via the spindle override when the coolant temperature is forecast to reach max temperature within this time.\\n0 to disable." },
+    { Setting_LaserCoolantMinPower, "Lowest spindle override value laser power is stepped down to." },
     { Setting_LaserCoolantMaxTemp, "" },
     { Setting_LaserCoolantTempPort, "Aux port number to use for coolant temperature monitoring." },
     { Setting_LaserCoolantOkPort, "Aux port number to use for coolant ok signal." },
@@ -186,6 +1063,17 @@ static void coolant_settings_save (void)
 
 static void coolant_settings_restore (void)
 {
+    coolant_settings.options.value = 0;
+    coolant_settings.resume_delay = 2.0f;
+    coolant_settings.fault_timeout = 30.0f;
+    coolant_settings.filter_time = 0;
+    coolant_settings.filter_samples = 4;
+    coolant_settings.warm_time = 0.0f;
+    coolant_settings.full_load_time = 10.0f;
+    coolant_settings.flow_pulses = 450.0f;
+    coolant_settings.min_flow = 2.0f;
+    coolant_settings.forecast_time = 0.0f;
+    coolant_settings.min_power = 50;
     coolant_settings.min_temp =
     coolant_settings.max_temp =
     coolant_settings.on_delay =
@@ -196,6 +1084,18 @@ static void coolant_settings_restore (void)
         coolant_settings.coolant_ok_port= n_din - 1;
     }
 
+#if N_EXTRA_ZONES
+    uint_fast8_t idx = N_EXTRA_ZONES;
+
+    do {
+        idx--;
+        coolant_settings.zone[idx].options.value = 0;
+        coolant_settings.zone[idx].ok_port = coolant_settings.zone[idx].temp_port = 0;
+        coolant_settings.zone[idx].filter_samples = 2;
+        coolant_settings.zone[idx].max_temp = 0.0f;
+    } while(idx);
+#endif
+
     coolant_settings_save();
 }
 
@@ -206,6 +1106,9 @@ static void coolant_settings_load (void)
     if(hal.nvs.memcpy_from_nvs((uint8_t *)&coolant_settings, nvs_address, sizeof(laser_coolant_settings_t), true) != NVS_TransferResult_OK)
         coolant_settings_restore();
 
+    if(coolant_settings.filter_samples == 0)
+        coolant_settings.filter_samples = 1;
+
     if(ioport_can_claim_explicit()) {
 
         // Sanity checks
@@ -221,24 +1124,111 @@ static void coolant_settings_load (void)
             ok = (can_monitor = ioport_claim(Port_Analog, Port_Input, &coolant_temp_port, "Coolant temperature"));
 
         ok &= ioport_claim(Port_Digital, Port_Input, &coolant_ok_port, "Coolant ok");
+
+#if N_EXTRA_ZONES
+        uint_fast8_t idx = N_EXTRA_ZONES;
+        coolant_zone_settings_t *cfg;
+
+        do {
+            cfg = &coolant_settings.zone[--idx];
+            if(cfg->filter_samples == 0)
+                cfg->filter_samples = 1;
+            if(cfg->options.ok_input && cfg->ok_port < n_din) {
+                zone[idx].ok_port = cfg->ok_port;
+                zone[idx].ok = zone[idx].ok_claimed = ioport_claim(Port_Digital, Port_Input, &zone[idx].ok_port, zone_ok_name[idx]);
+            }
+            if(cfg->options.temp_input && cfg->temp_port < n_ain) {
+                zone[idx].temp_port = cfg->temp_port;
+                zone[idx].temp_claimed = ioport_claim(Port_Analog, Port_Input, &zone[idx].temp_port, zone_temp_name[idx]);
+            }
+        } while(idx);
+#endif
     }
 
     if(ok) {
 
+        if(!coolant_irq_register())
+            protocol_enqueue_foreground_task(report_warning, "Laser coolant ok input does not support interrupts!");
+
         on_realtime_report = grbl.on_realtime_report;
         grbl.on_realtime_report = onRealtimeReport;
 
+        on_state_change = grbl.on_state_change;
+        grbl.on_state_change = onStateChanged;
+
+        on_stream_changed = grbl.on_stream_changed;
+        grbl.on_stream_changed = onStreamChanged;
+
+        on_spindle_programmed = grbl.on_spindle_programmed;
+        grbl.on_spindle_programmed = onSpindleProgrammed;
+
+        on_program_completed = grbl.on_program_completed;
+        grbl.on_program_completed = onProgramCompleted;
+
+        on_reset = grbl.on_reset;
+        grbl.on_reset = onReset;
+
+        coolant_model_reset();
+        task_add_delayed(coolant_poll, NULL, COOLANT_POLL_INTERVAL);
+
         memcpy(&on_coolant_changed, &hal.coolant, sizeof(coolant_ptrs_t));
         hal.coolant.set_state = coolantSetState;
     }
 }
 
+#if LASER_JOB_SUMMARY
+
+static void onJobStart (void)
+{
+    coolant_job.max_temp = thermal.temp_valid ? thermal.temp : 0.0f;
+    coolant_job.derate_time = 0;
+
+    if(on_job_start)
+        on_job_start();
+}
+
+static void onJobReport (char *summary)
+{
+    if(can_monitor)
+        laser_job_add(summary, "coolant max", ftoa(coolant_job.max_temp, 1), "deg");
+
+    if(coolant_settings.forecast_time > 0.0f)
+        laser_job_add(summary, "derated", ftoa((float)coolant_job.derate_time / 1000.0f, 1), "s");
+
+    if(on_job_report)
+        on_job_report(summary);
+}
+
+#endif
+
+#if LASER_TELEMETRY
+
+static laser_telemetry_sample_ptr on_telemetry_sample;
+
+static void onTelemetrySample (laser_telemetry_t *data)
+{
+    if((data->flags.coolant_temp = can_monitor && thermal.temp_valid))
+        data->coolant_temp = thermal.temp;
+
+    if((data->flags.coolant_flow = coolant_settings.options.flow_meter))
+        data->coolant_flow = flow.lpm;
+
+    data->flags.coolant_ok = coolant_ok_get() && coolant_zones_ok();
+    data->flags.coolant_on = coolant_on;
+    data->flags.derated = model.derate != 0;
+
+    if(on_telemetry_sample)
+        on_telemetry_sample(data);
+}
+
+#endif
+
 static void report_options (bool newopt)
 {
     on_report_options(newopt);
 
     if(!newopt)
-        report_plugin("Laser coolant", "0.06");
+        report_plugin("Laser coolant", "0.17");
 }
 
 void laser_coolant_init (void)
@@ -291,6 +1281,27 @@ void laser_coolant_init (void)
 
         settings_register(&setting_details);
 
+#if LASER_COOLANT_HISTORY
+        system_register_commands(&history_commands);
+#endif
+
+#if LASER_JOB_SUMMARY
+        laser_job_init();
+
+        on_job_start = laser_job.on_start;
+        laser_job.on_start = onJobStart;
+
+        on_job_report = laser_job.on_report;
+        laser_job.on_report = onJobReport;
+#endif
+
+#if LASER_TELEMETRY
+        laser_telemetry_init();
+
+        on_telemetry_sample = laser_telemetry.on_sample;
+        laser_telemetry.on_sample = onTelemetrySample;
+#endif
+
     } else
         protocol_enqueue_foreground_task(report_warning, "Laser coolant plugin failed to initialize!");
 }
@@ -24,6 +24,23 @@
 #ifndef _LASER_COOLANT_H_
 #define _LASER_COOLANT_H_
 
+// Plugin settings, not allocated in the core. Numbered from the free range after the
+// core laser coolant settings, $378 - $385.
+#define Setting_LaserCoolantOptions      ((setting_id_t)386)
+#define Setting_LaserCoolantResumeDelay  ((setting_id_t)387)
+#define Setting_LaserCoolantFaultTimeout ((setting_id_t)388)
+#define Setting_LaserCoolantFilterTime   ((setting_id_t)389)
+#define Setting_LaserCoolantFilterCount  ((setting_id_t)390)
+#define Setting_LaserCoolantWarmTime     ((setting_id_t)391)
+#define Setting_LaserCoolantFullLoadTime ((setting_id_t)392)
+#define Setting_LaserCoolantFlowPulses   ((setting_id_t)393)
+#define Setting_LaserCoolantMinFlow      ((setting_id_t)394)
+#define Setting_LaserCoolantForecastTime ((setting_id_t)395)
+#define Setting_LaserCoolantMinPower     ((setting_id_t)396)
+// Additional zone settings are $9z0 - $9z4 where z is the zone number, 1 - 3.
+#define Setting_LaserCoolantZoneBase     ((setting_id_t)900)
+#define ZONE_SETTING_ID(z, n) ((setting_id_t)(Setting_LaserCoolantZoneBase + (z) * 10 + (n)))
+
 void laser_coolant_init (void);
 
 #endif
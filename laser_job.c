@@ -0,0 +1,198 @@
+/*
+
+  laser_job.c - per job laser statistics, shared by the laser plugins
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if LASER_JOB_SUMMARY
+
+#include <string.h>
+
+#include "grbl/hal.h"
+#include "grbl/protocol.h"
+#include "grbl/planner.h"
+#include "grbl/stepper.h"
+
+#include "laser_job.h"
+
+#define LASER_JOB_SAMPLE_INTERVAL 10 // ms
+
+laser_job_ptrs_t laser_job = {0};
+
+// A job runs from the first laser on command to program end.
+static struct {
+    bool active;
+    uint32_t start_ms;
+    uint32_t last_ms;
+    uint32_t laser_on_ms;
+    uint32_t idle_ms;       // time in idle state, not only time waiting for input
+    float distance;         // mm
+    float feed_sum;         // achieved feed rate * ms
+    float programmed_sum;   // programmed feed rate * ms
+} job;
+
+static on_spindle_programmed_ptr on_spindle_programmed;
+static on_execute_realtime_ptr on_execute_realtime;
+static on_program_completed_ptr on_program_completed;
+static on_reset_ptr on_reset;
+static on_report_options_ptr on_report_options;
+
+void laser_job_add (char *summary, const char *label, char *value, const char *unit)
+{
+    if(strlen(summary) + strlen(label) + strlen(value) + strlen(unit) + 4 < LASER_JOB_SUMMARY_LENGTH) {
+        strcat(summary, ", ");
+        strcat(summary, label);
+        strcat(summary, " ");
+        strcat(summary, value);
+        if(*unit) {
+            strcat(summary, " ");
+            strcat(summary, unit);
+        }
+    }
+}
+
+static void job_start (void)
+{
+    memset(&job, 0, sizeof(job));
+
+    job.active = true;
+    job.start_ms = job.last_ms = hal.get_elapsed_ticks();
+
+    if(laser_job.on_start)
+        laser_job.on_start();
+}
+
+// Samples the executing block. Time in idle state is reported as idle time, it includes
+// time the sender did not keep up with the planner as well as dwells and pauses by the user.
+static void onExecuteRealtime (uint_fast16_t state)
+{
+    uint32_t ms, dt;
+
+    if(job.active && (dt = (ms = hal.get_elapsed_ticks()) - job.last_ms) >= LASER_JOB_SAMPLE_INTERVAL) {
+
+        job.last_ms = ms;
+
+        if(state == STATE_IDLE)
+            job.idle_ms += dt;
+        else if(state == STATE_CYCLE) {
+
+            plan_block_t *block = plan_get_current_block();
+
+            if(block && !block->condition.rapid_motion && block->spindle.state.on && block->spindle.rpm > 0.0f) {
+
+                float rate = st_get_realtime_rate();
+
+                job.laser_on_ms += dt;
+                job.distance += rate * (float)dt / 60000.0f;
+                job.feed_sum += rate * (float)dt;
+                job.programmed_sum += block->programmed_rate * (float)dt;
+            }
+        }
+    }
+
+    on_execute_realtime(state);
+}
+
+static void onSpindleProgrammed (spindle_ptrs_t *spindle, spindle_state_t state, float rpm, spindle_rpm_mode_t mode)
+{
+    if(!job.active && state.on && spindle->cap.laser)
+        job_start();
+
+    if(on_spindle_programmed)
+        on_spindle_programmed(spindle, state, rpm, mode);
+}
+
+static void onProgramCompleted (program_flow_t program_flow, bool check_mode)
+{
+    if(job.active && !check_mode) {
+
+        char summary[LASER_JOB_SUMMARY_LENGTH];
+
+        strcpy(summary, "Laser job: time ");
+        strcat(summary, ftoa((float)(hal.get_elapsed_ticks() - job.start_ms) / 1000.0f, 1));
+        strcat(summary, " s");
+        laser_job_add(summary, "laser on", ftoa((float)job.laser_on_ms / 1000.0f, 1), "s");
+        laser_job_add(summary, "lased", ftoa(job.distance, 1), "mm");
+        if(job.laser_on_ms) {
+            laser_job_add(summary, "feed", uitoa((uint32_t)(job.feed_sum / (float)job.laser_on_ms)), "");
+            strcat(summary, "/");
+            strcat(summary, uitoa((uint32_t)(job.programmed_sum / (float)job.laser_on_ms)));
+            strcat(summary, " mm/min");
+        }
+        laser_job_add(summary, "idle", ftoa((float)job.idle_ms / 1000.0f, 1), "s");
+
+        if(laser_job.on_report)
+            laser_job.on_report(summary);
+
+        report_message(summary, Message_Plain);
+
+        job.active = false;
+    }
+
+    if(on_program_completed)
+        on_program_completed(program_flow, check_mode);
+}
+
+// A job aborted by reset is not reported.
+static void onReset (void)
+{
+    job.active = false;
+
+    if(on_reset)
+        on_reset();
+}
+
+static void onReportOptions (bool newopt)
+{
+    on_report_options(newopt);
+
+    if(!newopt)
+        report_plugin("Laser job summary", "0.02");
+}
+
+// Called by each of the laser plugins, only the first call has any effect.
+void laser_job_init (void)
+{
+    static bool init_ok = false;
+
+    if(init_ok)
+        return;
+
+    init_ok = true;
+
+    on_spindle_programmed = grbl.on_spindle_programmed;
+    grbl.on_spindle_programmed = onSpindleProgrammed;
+
+    on_execute_realtime = grbl.on_execute_realtime;
+    grbl.on_execute_realtime = onExecuteRealtime;
+
+    on_program_completed = grbl.on_program_completed;
+    grbl.on_program_completed = onProgramCompleted;
+
+    on_reset = grbl.on_reset;
+    grbl.on_reset = onReset;
+
+    on_report_options = grbl.on_report_options;
+    grbl.on_report_options = onReportOptions;
+}
+
+#endif
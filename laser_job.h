@@ -0,0 +1,42 @@
+/*
+
+  laser_job.h - per job laser statistics, shared by the laser plugins
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _LASER_JOB_H_
+#define _LASER_JOB_H_
+
+#define LASER_JOB_SUMMARY_LENGTH 250
+
+typedef void (*laser_job_start_ptr)(void);
+typedef void (*laser_job_report_ptr)(char *summary);
+
+typedef struct {
+    laser_job_start_ptr on_start;   // Called when a job is started, plugins should reset their counters here.
+    laser_job_report_ptr on_report; // Called on program end, plugins should add their counters to the summary with laser_job_add().
+} laser_job_ptrs_t;
+
+extern laser_job_ptrs_t laser_job;
+
+void laser_job_init (void);
+void laser_job_add (char *summary, const char *label, char *value, const char *unit);
+
+#endif
@@ -0,0 +1,213 @@
+/*
+
+  laser_telemetry.c - binary push telemetry, shared by the laser plugins
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if LASER_TELEMETRY
+
+#include <math.h>
+
+#include "grbl/hal.h"
+#include "grbl/protocol.h"
+#include "grbl/planner.h"
+#include "grbl/nuts_bolts.h"
+
+#include "laser_telemetry.h"
+
+#define FRAME_LENGTH 31
+
+laser_telemetry_ptrs_t laser_telemetry = {0};
+
+static struct {
+    uint32_t interval;      // ms, 0 when stopped
+    uint32_t last_ms;
+    uint8_t sequence;
+    stream_write_n_ptr write_n;
+} telemetry = {0};
+
+static on_execute_realtime_ptr on_execute_realtime;
+static on_stream_changed_ptr on_stream_changed;
+static on_report_options_ptr on_report_options;
+
+static inline uint8_t *put_u16 (uint8_t *p, uint16_t value)
+{
+    *p++ = (uint8_t)value;
+    *p++ = (uint8_t)(value >> 8);
+
+    return p;
+}
+
+static inline uint8_t *put_u32 (uint8_t *p, uint32_t value)
+{
+    return put_u16(put_u16(p, (uint16_t)value), (uint16_t)(value >> 16));
+}
+
+static inline uint16_t saturate_u16 (float value)
+{
+    return value <= 0.0f ? 0 : (value >= 65535.0f ? 65535 : (uint16_t)lroundf(value));
+}
+
+// Frame layout, multibyte values are little endian:
+//  0 sync (0xA5), length, version, sequence number
+//  4 uint32_t time (ms)
+//  8 uint16_t controller state
+// 10 flags, PPI mode
+// 12 uint16_t S-value, uint16_t PWM value
+// 16 int16_t coolant temperature (0.1 deg C), uint16_t coolant flow (0.01 l/min)
+// 20 uint32_t PPI pulses, uint32_t clusters decoded
+// 28 uint16_t cluster decoder queue
+// 30 checksum, XOR of bytes 1 - 29
+static void telemetry_send (sys_state_t state, stream_write_n_ptr write_n)
+{
+    uint8_t frame[FRAME_LENGTH], *p = frame, checksum = 0;
+    uint_fast8_t idx;
+    laser_telemetry_t data = {0};
+    plan_block_t *block;
+
+    if(state == STATE_CYCLE && (block = plan_get_current_block()) && !block->condition.rapid_motion && block->spindle.state.on) {
+        data.flags.laser_on = block->spindle.rpm > 0.0f;
+        data.rpm = block->spindle.rpm;
+    }
+
+    if(laser_telemetry.on_sample)
+        laser_telemetry.on_sample(&data);
+
+    *p++ = LASER_TELEMETRY_SYNC;
+    *p++ = FRAME_LENGTH;
+    *p++ = LASER_TELEMETRY_VERSION;
+    *p++ = telemetry.sequence++;
+    p = put_u32(p, hal.get_elapsed_ticks());
+    p = put_u16(p, (uint16_t)state);
+    *p++ = data.flags.value;
+    *p++ = data.ppi_mode;
+    p = put_u16(p, saturate_u16(data.rpm));
+    p = put_u16(p, data.pwm);
+    p = put_u16(p, data.flags.coolant_temp ? (uint16_t)(int16_t)lroundf(data.coolant_temp * 10.0f) : 0);
+    p = put_u16(p, data.flags.coolant_flow ? saturate_u16(data.coolant_flow * 100.0f) : 0);
+    p = put_u32(p, data.ppi_pulses);
+    p = put_u32(p, data.clusters);
+    p = put_u16(p, data.decoder_queue);
+
+    for(idx = 1; idx < FRAME_LENGTH - 1; idx++)
+        checksum ^= frame[idx];
+
+    *p = checksum;
+
+    write_n(frame, FRAME_LENGTH);
+}
+
+static void onExecuteRealtime (uint_fast16_t state)
+{
+    on_execute_realtime(state);
+
+    if(telemetry.interval) {
+
+        uint32_t ms = hal.get_elapsed_ticks();
+
+        if(ms - telemetry.last_ms >= telemetry.interval) {
+            // Keep the rate steady unless we have fallen more than one interval behind.
+            telemetry.last_ms = ms - telemetry.last_ms >= telemetry.interval * 2 ? ms : telemetry.last_ms + telemetry.interval;
+            telemetry_send(state, telemetry.write_n);
+        }
+    }
+}
+
+// Frames are sent to the stream that enabled telemetry, a file stream
+// run from it shares its output and does not stop telemetry.
+static void onStreamChanged (stream_type_t type)
+{
+    if(on_stream_changed)
+        on_stream_changed(type);
+
+    if(telemetry.interval && type != StreamType_File && hal.stream.write_n != telemetry.write_n)
+        telemetry.interval = 0;
+}
+
+// $LTM - send a single frame.
+// $LTM=<rate> - push frames at <rate> Hz to the current stream, 0 to stop.
+static status_code_t telemetry_command (sys_state_t state, char *args)
+{
+    if(!hal.stream.write_n)
+        return Status_InvalidStatement;
+
+    if(args && *args) {
+
+        float rate;
+        uint_fast8_t cc = 0;
+
+        if(!read_float(args, &cc, &rate) || args[cc] != '\0')
+            return Status_BadNumberFormat;
+
+        if(rate < 0.0f || rate > (float)LASER_TELEMETRY_MAX_RATE || rate != truncf(rate))
+            return Status_InvalidStatement;
+
+        if((telemetry.interval = rate == 0.0f ? 0 : (uint32_t)lroundf(1000.0f / rate))) {
+            telemetry.write_n = hal.stream.write_n;
+            telemetry.last_ms = hal.get_elapsed_ticks();
+        }
+    } else
+        telemetry_send(state, hal.stream.write_n);
+
+    return Status_OK;
+}
+
+static const sys_command_t telemetry_command_list[] = {
+    {"LTM", telemetry_command, { .allow_blocking = On }, { .str = "send laser telemetry frame, $LTM=<rate> to push frames at <rate> Hz, 0 to stop" } }
+};
+
+static sys_commands_t telemetry_commands = {
+    .n_commands = sizeof(telemetry_command_list) / sizeof(sys_command_t),
+    .commands = telemetry_command_list
+};
+
+static void onReportOptions (bool newopt)
+{
+    on_report_options(newopt);
+
+    if(!newopt)
+        report_plugin("Laser telemetry", "0.01");
+}
+
+// Called by each of the laser plugins, only the first call has any effect.
+void laser_telemetry_init (void)
+{
+    static bool init_ok = false;
+
+    if(init_ok)
+        return;
+
+    init_ok = true;
+
+    on_execute_realtime = grbl.on_execute_realtime;
+    grbl.on_execute_realtime = onExecuteRealtime;
+
+    on_stream_changed = grbl.on_stream_changed;
+    grbl.on_stream_changed = onStreamChanged;
+
+    on_report_options = grbl.on_report_options;
+    grbl.on_report_options = onReportOptions;
+
+    system_register_commands(&telemetry_commands);
+}
+
+#endif
@@ -0,0 +1,70 @@
+/*
+
+  laser_telemetry.h - binary push telemetry, shared by the laser plugins
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _LASER_TELEMETRY_H_
+#define _LASER_TELEMETRY_H_
+
+#ifndef LASER_TELEMETRY_MAX_RATE
+#define LASER_TELEMETRY_MAX_RATE 100 // Hz
+#endif
+
+#define LASER_TELEMETRY_SYNC    0xA5 // not valid in ASCII output
+#define LASER_TELEMETRY_VERSION 1
+
+typedef union {
+    uint8_t value;
+    struct {
+        uint8_t laser_on     :1,
+                coolant_temp :1, // coolant temperature is valid
+                coolant_flow :1, // coolant flow is valid
+                coolant_ok   :1,
+                coolant_on   :1,
+                derated      :1, // laser power is derated by the coolant plugin
+                unused       :2;
+    };
+} laser_telemetry_flags_t;
+
+// Sample data, counters are free running.
+typedef struct {
+    laser_telemetry_flags_t flags;
+    uint8_t ppi_mode;
+    uint16_t pwm;           // programmed PWM value
+    float rpm;              // programmed S-value
+    float coolant_temp;     // deg C
+    float coolant_flow;     // l/min
+    uint32_t ppi_pulses;
+    uint32_t clusters;      // clusters decoded
+    uint16_t decoder_queue; // bytes queued by the threaded cluster decoder
+} laser_telemetry_t;
+
+typedef void (*laser_telemetry_sample_ptr)(laser_telemetry_t *data);
+
+typedef struct {
+    laser_telemetry_sample_ptr on_sample; // Called before a frame is sent, plugins should add their data here.
+} laser_telemetry_ptrs_t;
+
+extern laser_telemetry_ptrs_t laser_telemetry;
+
+void laser_telemetry_init (void);
+
+#endif
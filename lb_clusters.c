@@ -31,7 +31,16 @@
 #include "grbl/gcode.h"
 #include "grbl/protocol.h"
 
+#if LASER_JOB_SUMMARY
+#include "laser_job.h"
+#endif
+#if LASER_TELEMETRY
+#include "laser_telemetry.h"
+#endif
+
+#include <math.h>
 #include <string.h>
+#include <ctype.h>
 
 #ifndef LB_CLUSTER_SIZE
 #define LB_CLUSTER_SIZE 16
@@ -41,38 +50,220 @@
 #define LB_SVALUE_SCALING 0 // Change to 1 if S-values is to be multiplied by $30 value (max RPM).
 #endif
 
+#ifndef LB_SCAN_SHIFT
+#define LB_SCAN_SHIFT 0.0f // Distance in mm to shift S-values against the scan direction, 0 to disable.
+#endif
+
+#ifndef LB_SCAN_SHIFT_REVERSE
+#define LB_SCAN_SHIFT_REVERSE LB_SCAN_SHIFT // As above, for scanlines in the negative direction.
+#endif
+
+#define LB_SCAN_SHIFTING (LB_SCAN_SHIFT > 0.0f || LB_SCAN_SHIFT_REVERSE > 0.0f)
+
+#ifndef LB_CLUSTERS_THREADED
+#define LB_CLUSTERS_THREADED 0 // Change to 1 to decode the input stream on the second core of dual core processors.
+#endif
+
+#ifndef LB_RING_SIZE
+#define LB_RING_SIZE 512 // Decoder output queue size, must be a power of 2.
+#endif
+
+#ifndef LB_COMPRESSED_FILES
+#define LB_COMPRESSED_FILES 0 // Change to 1 to decompress heatshrink compressed files.
+#endif
+
+#if LB_COMPRESSED_FILES
+#ifndef LB_HS_WINDOW_BITS
+#define LB_HS_WINDOW_BITS 8 // heatshrink -w parameter, max 12.
+#endif
+#ifndef LB_HS_LOOKAHEAD_BITS
+#define LB_HS_LOOKAHEAD_BITS 4 // heatshrink -l parameter.
+#endif
+#endif
+
+#ifndef LB_REPLAY_BUFFER
+#define LB_REPLAY_BUFFER 0 // Size of buffer for raster replay, 0 to disable.
+#endif
+
+#if LB_REPLAY_BUFFER && !defined(LB_REPLAY_MCODE)
+#define LB_REPLAY_MCODE UserMCode_Generic0 // M100
+#endif
+
+#ifndef LB_BLANK_COLLAPSE
+#define LB_BLANK_COLLAPSE 0 // Change to 1 to collapse consecutive blank (all S0) cluster lines to a single move.
+#endif
+
+#ifndef LB_BLANK_FEEDRATE
+#define LB_BLANK_FEEDRATE 0 // Feed rate for collapsed blank moves, 0 for rapid.
+#endif
+
+// The line is decoded in place, S-values and extra parameters are referenced
+// by their offsets in the line buffer.
 static struct {
     char block[LINE_BUFFER_SIZE];
     char *s;
-    char *cmd;
     char eol;
+    bool file;
+    bool buffering;
+    bool passthru;
+    bool modal;     // cluster line without G1 prefix
+    bool suppress;  // line generated by the decoder, suppress status response
     uint_fast16_t length;
 } input = {0};
 
+// Modal state tracked from the input stream.
+static struct {
+    uint_fast8_t motion;
+    bool relative;
+    char letter;
+    bool comment;
+    bool system;    // $ command, not parsed by the gcode parser
+    bool midline;
+    bool fraction;
+    uint_fast8_t digits;
+    uint_fast16_t value;
+    uint_fast8_t flen;
+    char fbuf[12];
+    char feed[12];
+} modal = {0};
+
+#if LB_BLANK_COLLAPSE
+
+typedef enum {
+    Blank_Idle = 0,
+    Blank_Move,
+    Blank_Restore,
+    Blank_Held
+} blank_state_t;
+
+// Consecutive blank cluster lines and the plain moves between them are
+// collapsed to a single laser off move followed by a line restoring the
+// modal motion mode and feed rate. The modal state to restore is captured
+// when a line is collapsed, the line ending the sequence has already been
+// scanned when the collapsed move is output.
+static struct {
+    blank_state_t state;
+    bool held;              // line that ended the sequence is waiting for output
+    uint_fast16_t lines;    // number of lines collapsed
+    uint_fast16_t oks;      // number of ok responses to send for the collapsed move
+    uint_fast16_t held_length;
+    uint_fast8_t motion;    // modal motion mode after the last collapsed line
+    char feed[12];          // modal feed rate after the last collapsed line
+    float distance[3];
+    char block[56];
+} blank = {0};
+
+#endif
+
+// Consecutive cluster lines moving in the same direction along the same axis form a scanline.
+// When shifting S-values only the first line of a scanline is shifted, the distance it is
+// shortened by is carried to the end of the scanline and added by a laser off move before
+// the line that ends it.
 static struct {
-    char block[34];
-    char param[24];
-    char sval[LB_CLUSTER_SIZE][10];
+    char axis;
+    bool held;              // line that ended the scanline is waiting for output
+    uint_fast16_t held_length;
+    float pending;          // distance to add at the end of the scanline, 0 if none
+    char block[40];
+} scan = {0};
+
+static struct {
+    char block[40];
     char *s;
     char *cmd;
+    uint16_t param;
+    uint16_t sval[LB_CLUSTER_SIZE];    // offsets of S-values in the line buffer, 0 for S0
     uint_fast16_t count;
     uint_fast16_t next;
+    bool shifted;                       // first sub-move has adjusted length
+    float step;
+    float first;
 } cluster;
 
 static stream_read_ptr file_read = NULL, stream_read = NULL;
+#if LASER_JOB_SUMMARY || LASER_TELEMETRY
+static volatile uint32_t n_clusters = 0; // clusters decoded, free running
+#endif
 static on_stream_changed_ptr on_stream_changed;
 static on_report_handlers_init_ptr on_report_handlers_init;
 static status_message_ptr status_message = NULL;
 static on_report_options_ptr on_report_options;
 static on_reset_ptr on_reset;
 
+#if LB_CLUSTERS_THREADED
+
+// The core ftoa() and uitoa() functions share a static buffer, the decoder has its own
+// versions since it runs concurrently with the core.
+
+static char *lb_ftoa (float n, uint8_t decimal_places)
+{
+    static char buf[STRLEN];
+
+    bool neg;
+    char *s = buf;
+    uint32_t ipart;
+    uint_fast8_t idx, digits = 0;
+    float round = 0.5f;
+
+    if((neg = n < 0.0f))
+        n = -n;
+
+    for(idx = 0; idx < decimal_places; idx++)
+        round *= 0.1f;
+
+    n += round;
+    ipart = (uint32_t)n;
+    n -= (float)ipart;
+
+    do {
+        buf[STRLEN - 1 - digits++] = '0' + ipart % 10;
+    } while((ipart /= 10));
+
+    if(neg)
+        *s++ = '-';
+
+    memmove(s, &buf[STRLEN - digits], digits);
+    s += digits;
+    *s++ = '.';
+
+    while(decimal_places--) {
+        n *= 10.0f;
+        *s++ = '0' + (char)(ipart = (uint32_t)n);
+        n -= (float)ipart;
+    }
+
+    *s = '\0';
+
+    return buf;
+}
+
+static char *lb_uitoa (uint32_t n)
+{
+    static char buf[12];
+
+    char *s = &buf[sizeof(buf) - 1];
+
+    *s = '\0';
+
+    do {
+        *--s = '0' + n % 10;
+    } while((n /= 10));
+
+    return s;
+}
+
+#else
+#define lb_ftoa ftoa
+#define lb_uitoa uitoa
+#endif
+
 static inline char *get_value (char *v, uint_fast8_t *offset, uint_fast16_t scale)
 {
     float val;
 
     read_float(v, offset, &val);
 
-    return ftoa(val / (float)scale, 8);
+    return lb_ftoa(val / (float)scale, 8);
 }
 
 #if LB_SVALUE_SCALING
@@ -85,146 +276,523 @@ static inline char *get_s_value (char *v)
 
     read_float(v, &cc, &val);
 
-    s = ftoa(val * settings.spindle.rpm_max, 0);
+    s = lb_ftoa(val * settings.spindle.rpm_max, 0);
 
-    *strchr(s, '.') = input.eol;
+    *strchr(s, '.') = '\0';
 
     return s;
 }
 
 #endif
 
-// File stream decoder
-
-static inline void file_fill_buffer (void)
+static void modal_word_end (void)
 {
-    int16_t c;
+    if(modal.digits && !modal.fraction) {
+        if(modal.letter == 'G') switch(modal.value) {
+
+            case 0:
+            case 1:
+            case 2:
+            case 3:
+            case 5:
+            case 33:
+            case 38:
+            case 73:
+            case 76:
+            case 80:
+            case 81:
+            case 82:
+            case 83:
+            case 84:
+            case 85:
+            case 86:
+            case 87:
+            case 88:
+            case 89:
+                modal.motion = modal.value;
+                break;
 
-    if(cluster.count == 0) {
+            case 90:
+            case 91:
+                modal.relative = modal.value == 91;
+                break;
 
-        char *s = input.block;
+        } else if(modal.letter == 'M' && (modal.value == 2 || modal.value == 30)) {
+            modal.motion = 1; // Program end resets motion mode to G1
+            modal.relative = false;
+        }
+    } else if(modal.letter == 'G' && (modal.value == 33 || modal.value == 38))
+        modal.motion = 255; // G33.1, G38.x - other fractional G-codes do not change the motion mode
 
-        input.s = s;
-        input.length = 0;
+    if(modal.letter == 'F' && modal.digits) {
+        modal.fbuf[modal.flen] = '\0';
+        strcpy(modal.feed, modal.fbuf);
+    }
 
-        while((c = file_read()) != SERIAL_NO_DATA) {
-            *s++ = (char)c;
-            input.length++;
-            if((char)c == '\n' || (char)c == '\r') {
-                if(input.length == 1 && input.eol && input.eol != (char)c) {
-                    input.eol = '\0';
-                    input.s = s;
-                    input.length = 0;
-                }
-                input.eol = c;
-                break;
+    modal.letter = '\0';
+}
+
+// Tracks the modal motion mode from the characters read from the input stream,
+// lines with system commands ($) are not parsed by the gcode parser and skipped.
+static void modal_scan (char c)
+{
+    if(c == '\n' || c == '\r') {
+        if(!(modal.comment || modal.system))
+            modal_word_end();
+        modal.comment = modal.system = modal.midline = false;
+        return;
+    }
+
+    if(modal.system)
+        return;
+
+    if(!modal.midline && c != ' ') {
+        modal.midline = true;
+        if((modal.system = c == '$'))
+            return;
+    }
+
+    if(modal.comment) {
+        if(c == ')')
+            modal.comment = false;
+    } else switch(c) {
+
+        case '(':
+        case ';':
+            modal_word_end();
+            modal.comment = true;
+            break;
+
+        case ' ':
+        case '-':
+        case '+':
+            break;
+
+        case '.':
+            if(modal.letter == 'F' && modal.flen < sizeof(modal.fbuf) - 1)
+                modal.fbuf[modal.flen++] = c;
+            modal.fraction = true;
+            break;
+
+        default:
+            if(isdigit(c)) {
+                if(modal.letter == 'F' && modal.flen < sizeof(modal.fbuf) - 1)
+                    modal.fbuf[modal.flen++] = c;
+                modal.digits++;
+                if(!modal.fraction && modal.value < 1000)
+                    modal.value = modal.value * 10 + (c - '0');
+            } else if(isalpha(c)) {
+                modal_word_end();
+                modal.letter = CAPS(c);
+                modal.value = modal.digits = modal.flen = 0;
+                modal.fraction = false;
             }
-        }
+            break;
+    }
+}
 
-        *s = '\0';
+static inline bool is_axis_letter (char c)
+{
+    return strchr("XYZABCUVWxyzabcuvw", c) != NULL;
+}
 
-        if(input.length > 5 && !strncasecmp(input.block, "G1", 2) && strchr(input.block, ':')) {
+// Checks the last character added to the line buffer, returns false when
+// the line cannot be a cluster line and should be passed through as is.
+static inline bool is_cluster_candidate (char *block, uint_fast16_t length)
+{
+    bool ok = true;
 
-            char *s2 = input.block, *s3;
-            uint_fast8_t params = 0;
+    switch(length) {
 
-            s = cluster.block;
+        case 1:
+            input.modal = modal.motion == 1 && is_axis_letter(*block);
+            ok = input.modal || *block == 'G' || *block == 'g';
+            break;
 
-            while((c = *s2++)) {
-                if(c != ' ')
-                    *s++ = c;
-                if(c == 'S')
-                    break;
-            }
-            *s = '\0';
+        case 2:
+            ok = input.modal || block[1] == '1';
+            break;
 
-            cluster.s = s;
-            cluster.cmd = cluster.block;
-            cluster.count = cluster.next = 0;
+        case 3:
+            ok = input.modal || !(isdigit(block[2]) || block[2] == '.');
+            break;
+    }
+
+#if LB_BLANK_COLLAPSE
+    if(blank.lines)
+        ok = true; // Buffer line to check if it can be collapsed.
+#endif
+
+    if(scan.pending != 0.0f)
+        ok = true; // Buffer line to check if it continues the scanline.
+
+    return ok;
+}
+
+// Splits a cluster line in the line buffer, returns false if it is not a valid cluster line.
+// The line is only modified if valid. Modal lines, without the G1 prefix, get it added.
+static inline char *cluster_sval (uint_fast16_t idx)
+{
+    return cluster.sval[idx] ? input.block + cluster.sval[idx] : "0";
+}
+
+static void cluster_set_step (char *step)
+{
+    strcpy(cluster.block + 3, step);
+    cluster.s = strchr(cluster.block, '\0');
+    while(*(cluster.s - 1) == '0')
+        *(--cluster.s) = '\0';
+    strcat(cluster.s++, "S");
+}
+
+// Compensates for laser response delay by shifting the S-values against the scan direction,
+// the direction is given by the sign of the (relative) axis move.
+// Whole pixels are dropped from the start of the first line of the scanline and the remainder
+// is taken from the first sub-move. The shift is carried to the end of the scanline.
+static void scan_start (uint_fast8_t axis, float distance)
+{
+    float step = distance / (float)cluster.count, shift, fraction;
+    uint_fast16_t pixels;
+
+    if((shift = step < 0.0f ? LB_SCAN_SHIFT_REVERSE : LB_SCAN_SHIFT) <= 0.0f)
+        return;
+
+    if((pixels = (uint_fast16_t)((shift + 0.0001f) / fabsf(step))) >= cluster.count)
+        return; // Whole line shifted out, try next line.
+
+    fraction = shift / fabsf(step) - (float)pixels;
+
+    if(pixels) {
+        memmove(cluster.sval, cluster.sval + pixels, (cluster.count - pixels) * sizeof(uint16_t));
+        cluster.count -= pixels;
+    }
+
+    if((cluster.shifted = fraction * fabsf(step) >= 0.0001f)) {
+        cluster.step = step;
+        cluster.first = step * (1.0f - fraction);
+    } else
+        fraction = 0.0f;
+
+    scan.axis = CAPS(input.block[axis]);
+    scan.pending = step * ((float)pixels + fraction);
+}
+
+// Outputs the laser off move that completes the scanline.
+static void scan_end (void)
+{
+    char *s = scan.block;
+
+    *s++ = 'G';
+    *s++ = '1';
+    *s++ = scan.axis;
+    strcpy(s, lb_ftoa(scan.pending, 5));
+    strcat(s, "S0");
+    s = strchr(s, '\0');
+    *s++ = input.eol ? input.eol : ASCII_LF;
+    *s = '\0';
+
+    scan.pending = 0.0f;
+    input.suppress = true;
+    input.s = scan.block;
+    input.length = s - scan.block;
+}
+
+// Called for each line that is not collapsed, starts a scanline if the line is a cluster line
+// in relative mode. Returns true if the line ends the current scanline and is held.
+static bool scan_shift (void)
+{
+    bool end;
+    float distance = 0.0f;
+    uint_fast8_t axis = input.modal ? 0 : 2, cc = axis + 1;
+
+    if(!(cluster.count > 1 && modal.relative && read_float(input.block, &cc, &distance)))
+        distance = 0.0f;
+
+    if((end = scan.pending != 0.0f)) {
+        if(distance != 0.0f && CAPS(input.block[axis]) == scan.axis && (distance < 0.0f) == (scan.pending < 0.0f))
+            return false;
+        // Hold the line while the move completing the scanline is output.
+        scan.held = true;
+        scan.held_length = input.length;
+        scan_end();
+    }
+
+    if(distance != 0.0f)
+        scan_start(axis, distance);
+
+    return end;
+}
+
+static bool cluster_parse (void)
+{
+    char c, *s1 = input.block, *s2, *s3;
+    uint_fast8_t params = 0, axis = input.modal ? 0 : 2;
+    uint_fast16_t prefix = 0, length = 0, max_length = 0, count = 1;
+
+    while((c = *s1++) && c != 'S') {
+        if(c != ' ')
+            prefix++;
+    }
+
+    if(c != 'S' || prefix < axis + 2)
+        return false;
+
+    s2 = s1; // Start of S-values
+
+    while((c = *s1++) && c != input.eol) {
+        if(c == ':') {
+            if(++count > LB_CLUSTER_SIZE)
+                return false;
+            max_length = max(max_length, length);
+            length = 0;
+        } else
+            length++;
+    }
+
+    if(prefix + (2 - axis) + max(max_length, length) + 16 >= sizeof(cluster.block))
+        return false;
+
+    // Remove spaces from the command part and terminate it at the S-word.
+    s1 = s3 = input.block;
+    while(s3 < s2 - 1) {
+        if(*s3 != ' ')
+            *s1++ = *s3;
+        s3++;
+    }
+    *s1 = '\0';
+
+    cluster.count = cluster.next = 0;
+
+    s3 = s2;
+    while((c = *s2)) {
+        if(c == ':') {
+            *s2 = '\0';
+            cluster.sval[cluster.count++] = s3 - input.block;
+            s3 = s2 + 1;
+        } else if(c == input.eol)
+            *s2 = '\0';
+        s2++;
+    }
+    cluster.sval[cluster.count++] = s3 - input.block;
+
+    s1 = get_value(input.block + axis + 1, &params, cluster.count);
+    cluster.param = input.block[axis + 1 + params] != '\0' ? axis + 1 + params : 0;
+
+    cluster.block[0] = 'G';
+    cluster.block[1] = '1';
+    cluster.block[2] = input.block[axis];
+    cluster_set_step(s1);
+    cluster.cmd = cluster.block;
+
+    cluster.shifted = false;
+
+    return true;
+}
+
+// Outputs the next move of the cluster.
+static void cluster_next (void)
+{
+    char *s;
+
+    if(cluster.shifted) {
+        if(cluster.next == 0)
+            cluster_set_step(lb_ftoa(cluster.first, 8));
+        else if(cluster.next == 1)
+            cluster_set_step(lb_ftoa(cluster.step, 8));
+    }
+
+    s = cluster.s;
 
-            s3 = s2;
-            while((c = *s2)) {
-                if(c == ':') {
-#if LB_SVALUE_SCALING
-                    *s2++ = '\0';
-                    strcpy(cluster.sval[cluster.count++], get_s_value(s3));
-#else
-                    *s2++ = input.eol;
-                    c = *s2;
-                    *s2 = '\0';
-                    strcpy(cluster.sval[cluster.count++], s3);
-                    *s2 = (char)c;
-#endif
-                    if(cluster.count == LB_CLUSTER_SIZE) {
-                        cluster.count = input.length = 0;
-                        return;
-                    }
-                    s3 = s2;
-                }
-                s2++;
-            }
 #if LB_SVALUE_SCALING
-            strcpy(cluster.sval[cluster.count++], get_s_value(s3));
+    strcpy(s, get_s_value(cluster_sval(cluster.next++)));
 #else
-            *s2 = '\0';
-            strcpy(cluster.sval[cluster.count++], s3);
-#endif
-            s = cluster.cmd + 3;
-            s2 = get_value(s, &params, cluster.count);
-            if(strchr(s, '\0') != s + params + 1) {
-                strcpy(cluster.param, s + params);
-                *strchr(cluster.param, 'S') = input.eol;
-                *strchr(cluster.sval[0], input.eol) = '\0';
-            }
+    strcpy(s, cluster_sval(cluster.next++));
+#endif
+    if(cluster.param) {
+        strcat(s, input.block + cluster.param);
+        cluster.param = 0;
+    }
+    s = strchr(s, '\0');
+    *s++ = input.eol;
+    *s = '\0';
+
+//    if(cluster.next == 2) !! oddly this slows down the parser
+//        cluster.cmd += 2;
+    if(cluster.next == cluster.count)
+        cluster.count = 0;
+
+    input.s = cluster.cmd;
+    input.length = s - cluster.cmd;
+}
+
+#if LB_BLANK_COLLAPSE
+
+static bool blank_add_distance (char axis, float distance)
+{
+    char *idx = strchr("XYZ", CAPS(axis));
+
+    if(idx && axis)
+        blank.distance[idx - "XYZ"] += distance;
+
+    return idx && axis;
+}
+
+// Returns true if the parsed cluster line is all S0 with no other parameters than F.
+static bool cluster_is_blank (void)
+{
+    uint_fast16_t idx = cluster.count;
+    char *s;
+
+    do {
+        s = cluster_sval(--idx);
+        if(*s == '\0' || strspn(s, "0.") != strlen(s))
+            return false;
+    } while(idx);
+
+    if(cluster.param && (input.block[cluster.param] != 'F' || strspn(input.block + cluster.param + 1, "0123456789.") != strlen(input.block + cluster.param + 1)))
+        return false;
+
+    return true;
+}
+
+// Returns true if the line in the line buffer was collapsed.
+static bool blank_collapse (void)
+{
+    bool ok = false;
+    float value;
+    uint_fast8_t cc = 0;
+
+    if(!modal.relative || (scan.pending != 0.0f && !strchr("XYZ", scan.axis)))
+        return false;
+
+    if(cluster.count) {
+        uint_fast8_t axis = input.modal ? 0 : 2;
+        cc = axis + 1;
+        if((ok = cluster_is_blank() && read_float(input.block, &cc, &value) && blank_add_distance(input.block[axis], value)))
+            cluster.count = 0;
+    } else if(blank.lines) {
+
+        // Plain G0/G1 move with axis words only?
+
+        char c;
+        float distance[3];
+
+        memcpy(distance, blank.distance, sizeof(distance));
+
+        ok = true;
+        while(ok && (c = CAPS(input.block[cc])) && c != input.eol) {
+            cc++;
+            if(c == ' ')
+                continue;
+            if(c == 'G')
+                ok = read_float(input.block, &cc, &value) && (value == 0.0f || value == 1.0f);
             else
-                *cluster.param = '\0';
-            strcpy(s, s2);
-            cluster.s = strchr(s, '\0');
-            while(*(cluster.s - 1) == '0')
-                *(--cluster.s) = '\0';
-            strcat(cluster.s++, "S");
+                ok = read_float(input.block, &cc, &value) && blank_add_distance(c, value);
         }
+
+        if(!ok)
+            memcpy(blank.distance, distance, sizeof(distance));
     }
 
-    if(cluster.count) {
-        strcpy(cluster.s, cluster.sval[cluster.next++]);
-        if(*cluster.param) {
-            strcat(cluster.s, cluster.param);
-            *cluster.param = '\0';
+    if(ok) {
+        if(scan.pending != 0.0f) {
+            // Collapsed move completes the scanline.
+            blank_add_distance(scan.axis, scan.pending);
+            scan.pending = 0.0f;
         }
-//        if(cluster.next == 2) !! oddly this slows down the parser
-//            cluster.cmd += 2;
-        if(cluster.next == cluster.count)
-            cluster.count = 0;
-        input.s = cluster.cmd;
-        input.length = strlen(cluster.cmd);
+        blank.lines++;
+        blank.motion = modal.motion;
+        strcpy(blank.feed, modal.feed);
     }
+
+    return ok;
 }
 
-static int16_t file_decoder (void)
+// Outputs the collapsed move or the line restoring modal state.
+static void blank_next (void)
 {
-    int16_t c;
+    char *s = blank.block;
 
-    if(input.length == 0)
-        file_fill_buffer();
+    if(blank.state == Blank_Move) {
 
-    if(input.length) {
-        c = *input.s++;
-        input.length--;
-    } else
-        c = SERIAL_NO_DATA;
+        uint_fast8_t idx;
 
-    return c;
+        strcpy(s, LB_BLANK_FEEDRATE > 0 ? "G1" : "G0");
+        for(idx = 0; idx < 3; idx++) {
+            if(blank.distance[idx] != 0.0f) {
+                s = strchr(s, '\0');
+                *s++ = "XYZ"[idx];
+                strcpy(s, lb_ftoa(blank.distance[idx], 5));
+                blank.distance[idx] = 0.0f;
+            }
+        }
+        strcat(s, "S0"); // laser power is modal, keep it off for the line following the sequence
+#if LB_BLANK_FEEDRATE > 0
+        strcat(s, "F");
+        strcat(s, lb_uitoa(LB_BLANK_FEEDRATE));
+#endif
+        blank.oks = blank.lines;
+        blank.lines = 0;
+        blank.state = Blank_Restore;
+    } else {
+        *s++ = 'G';
+        strcpy(s, lb_uitoa(blank.motion <= 3 ? blank.motion : 1));
+        if(*blank.feed) {
+            strcat(s, "F");
+            strcat(s, blank.feed);
+        }
+        input.suppress = true;
+        blank.state = blank.held ? Blank_Held : Blank_Idle;
+    }
+
+    s = strchr(s, '\0');
+    *s++ = input.eol ? input.eol : ASCII_LF;
+    *s = '\0';
+
+    input.s = blank.block;
+    input.length = s - blank.block;
 }
 
-// "Normal" stream decoder
+static void blank_reset (void)
+{
+    blank.state = Blank_Idle;
+    blank.lines = blank.oks = 0;
+    blank.held = false;
+    blank.distance[0] = blank.distance[1] = blank.distance[2] = 0.0f;
+}
 
-static int16_t stream_fill_buffer (void)
+#endif // LB_BLANK_COLLAPSE
+
+static int16_t fill_buffer (stream_read_ptr read)
 {
     static char *s = NULL;
 
     int16_t c;
 
+#if LB_BLANK_COLLAPSE
+    if(blank.state == Blank_Held) {
+        blank.state = Blank_Idle;
+        blank.held = false;
+        if(cluster.count == 0) {
+            input.s = input.block;
+            input.length = blank.held_length;
+            return 0;
+        }
+    } else if(blank.state != Blank_Idle) {
+        blank_next();
+        return 0;
+    }
+#endif
+
+    if(scan.held) {
+        scan.held = false;
+        if(cluster.count == 0) {
+            input.s = input.block;
+            input.length = scan.held_length;
+            return 0;
+        }
+    }
+
     if(s == NULL || input.s == NULL) {
         input.s = s = input.block;
         cluster.count = input.length = 0;
@@ -232,13 +800,36 @@ static int16_t stream_fill_buffer (void)
 
     if(cluster.count == 0) {
 
-        c = stream_read();
+        if((c = read()) == SERIAL_NO_DATA && input.file && input.length)
+            c = input.eol ? input.eol : '\n'; // Terminate last line of file if no EOL
+
+        if(c >= 0 && c != ASCII_CAN)
+            modal_scan((char)c);
 
         if(c == SERIAL_NO_DATA || c == ASCII_CAN) {
 
             if(ABORTED) {
                 cluster.count = input.length = 0;
+                scan.pending = 0.0f;
+                s = NULL;
+#if LB_BLANK_COLLAPSE
+                blank_reset();
+#endif
+            }
+#if LB_BLANK_COLLAPSE
+            else if(c == SERIAL_NO_DATA && blank.lines && input.length == 0) {
+                // No more input available, output the collapsed move.
+                s = NULL;
+                blank.state = Blank_Move;
+                blank_next();
+                return 0;
+            }
+#endif
+            else if(LB_SCAN_SHIFTING && c == SERIAL_NO_DATA && input.file && scan.pending != 0.0f && input.length == 0) {
+                // End of file, complete the scanline.
                 s = NULL;
+                scan_end();
+                return 0;
             }
 
             return c;
@@ -259,129 +850,830 @@ static int16_t stream_fill_buffer (void)
                 return SERIAL_NO_DATA;
             }
             input.eol = (char)c;
+        } else if(!is_cluster_candidate(input.block, input.length)) {
+            // Not a cluster, deliver what is buffered and pass the rest of the line through.
+            s = NULL;
+            input.passthru = true;
+            return 0;
         } else
             return SERIAL_NO_DATA;
 
         *s = '\0';
 
-        if(input.length > 5 && !strncasecmp(input.block, "G1", 2) && strchr(input.block, ':')) {
-
-            char *s2 = input.block, *s3;
-            uint_fast8_t params = 0;
-
-            s = cluster.block;
-
-            while((c = *s2++)) {
-                if(c != ' ')
-                    *s++ = c;
-                if(c == 'S')
-                    break;
-            }
-            *s = '\0';
-
-            cluster.s = s;
-            cluster.cmd = cluster.block;
-            strcpy(cluster.param, cluster.block);
-            cluster.count = cluster.next = 0;
+        if(!(input.length > 5 && strchr(input.block, ':') && cluster_parse())) {
+            cluster.count = 0;
+            s = NULL;
+        }
+#if LASER_JOB_SUMMARY || LASER_TELEMETRY
+        else
+            n_clusters++;
+#endif
 
-            s3 = s2;
-            while((c = *s2)) {
-                if(c == ':') {
-#if LB_SVALUE_SCALING
-                    *s2++ = '\0';
-                    strcpy(cluster.sval[cluster.count++], get_s_value(s3));
-#else
-                    *s2++ = input.eol;
-                    c = *s2;
-                    *s2 = '\0';
-                    strcpy(cluster.sval[cluster.count++], s3);
-                    *s2 = (char)c;
-#endif
-                    if(cluster.count == LB_CLUSTER_SIZE) {
-                        s = NULL;
-                        return SERIAL_NO_DATA;
-                    }
-                    s3 = s2;
-                }
-                s2++;
-            }
-#if LB_SVALUE_SCALING
-            strcpy(cluster.sval[cluster.count++], get_s_value(s3));
-#else
-            *s2 = '\0';
-            strcpy(cluster.sval[cluster.count++], s3);
-#endif
-            s = cluster.cmd + 3;
-            s2 = get_value(s, &params, cluster.count);
-            if(strchr(s, '\0') != s + params + 1) {
-                strcpy(cluster.param, s + params);
-                *strchr(cluster.param, 'S') = input.eol;
-                *strchr(cluster.sval[0], input.eol) = '\0';
-            }
-            else
-                *cluster.param = '\0';
-            strcpy(s, s2);
-            cluster.s = strchr(s, '\0');
-            while(*(cluster.s - 1) == '0')
-                *(--cluster.s) = '\0';
-            strcat(cluster.s++, "S");
-        } else
+#if LB_BLANK_COLLAPSE
+        if(blank_collapse()) {
             s = NULL;
+            return SERIAL_NO_DATA;
+        }
+#endif
+
+        if(LB_SCAN_SHIFTING && scan_shift())
+            return 0;
+
+#if LB_BLANK_COLLAPSE
+        if(blank.lines) {
+            // Output the collapsed move before the line that ended the sequence.
+            blank.held = true;
+            blank.held_length = input.length;
+            blank.state = Blank_Move;
+            blank_next();
+            return 0;
+        }
+#endif
     }
 
     if(cluster.count) {
-        strcpy(cluster.s, cluster.sval[cluster.next++]);
-        if(*cluster.param) {
-            strcat(cluster.s, cluster.param);
-            *cluster.param = '\0';
-        }
-//        if(cluster.next == 2) !! oddly this slows down the parser
-//            cluster.cmd += 2;
-        if(cluster.next == cluster.count) {
+        cluster_next();
+        if(cluster.count == 0)
             s = NULL;
-            cluster.count = 0;
-        }
-        input.s = cluster.cmd;
-        input.length = strlen(cluster.cmd);
     }
 
     return 0;
 }
 
-static int16_t stream_decoder (void)
+static inline int16_t decode (stream_read_ptr read)
 {
-    static bool buffering = true;
-
     int16_t c;
 
-    if(buffering) {
-        while((c = stream_fill_buffer()) != 0) {
+    if(input.buffering) {
+        while((c = fill_buffer(read)) != 0) {
             if(ABORTED)
                 break;
             return c;
         }
-        buffering = false;
+        input.buffering = false;
     }
 
     if(input.length) {
         c = *input.s++;
         input.length--;
+    } else if(input.passthru) {
+        if((c = read()) == SERIAL_NO_DATA && input.file)
+            c = input.eol ? input.eol : '\n'; // Terminate last line of file if no EOL
+        if(c >= 0 && c != ASCII_CAN)
+            modal_scan((char)c);
+        if(c == '\n' || c == '\r' || c == ASCII_CAN) {
+            if(c == '\n' || c == '\r')
+                input.eol = (char)c;
+            input.passthru = false;
+            input.buffering = true;
+        }
     } else {
-        buffering = true;
+        input.buffering = true;
         c = SERIAL_NO_DATA;
     }
 
     return c;
 }
 
-// Only respond with a single "ok" message for each cluster
-// or terminate cluster unpacking if error status reported.
-static status_code_t cluster_status_message (status_code_t status_code)
+// File stream decoder
+
+#if LB_COMPRESSED_FILES
+
+/*
+  Streaming heatshrink (LZSS) decompressor.
+  Compressed files start with a four byte header, 0x89 'H' 'S' followed by the window size
+  in the upper and the lookahead size in the lower nibble. 0x89 is not valid at the start of
+  UTF-8 text, other files are passed through unchanged with a leading UTF-8 BOM stripped.
+*/
+
+typedef enum {
+    HS_Detect = 0,
+    HS_Plain,
+    HS_Tag,
+    HS_Literal,
+    HS_Index,
+    HS_Count
+} hs_state_t;
+
+#define HS_WINDOW_MASK ((1 << LB_HS_WINDOW_BITS) - 1)
+
+static const uint8_t hs_magic[] = { 0x89, 'H', 'S', (LB_HS_WINDOW_BITS << 4) | LB_HS_LOOKAHEAD_BITS };
+static const uint8_t utf8_bom[] = { 0xEF, 0xBB, 0xBF };
+
+static struct {
+    hs_state_t state;
+    uint8_t header[sizeof(hs_magic)];
+    uint_fast8_t n_header;  // number of bytes read while detecting the file type
+    uint_fast8_t replay;    // number of these passed on as plain text
+    uint32_t bits;          // input bit accumulator
+    uint_fast8_t n_bits;    // number of bits in accumulator
+    uint_fast16_t head;
+    uint_fast16_t offset;   // backreference offset
+    uint_fast16_t count;    // remaining backreference length
+    uint8_t window[1 << LB_HS_WINDOW_BITS];
+} hs;
+
+static inline void hs_reset (void)
+{
+    hs.state = HS_Detect;
+    hs.n_header = hs.replay = 0;
+    hs.bits = hs.n_bits = 0;
+    hs.head = hs.offset = hs.count = 0;
+    memset(hs.window, 0, sizeof(hs.window));
+}
+
+// Returns false if no more input is available, decoding resumes on the next call.
+static bool hs_get_bits (uint_fast8_t n, uint_fast16_t *value)
+{
+    int16_t c;
+
+    while(hs.n_bits < n) {
+        if((c = file_read()) < 0)
+            return false;
+        hs.bits = (hs.bits << 8) | (uint8_t)c;
+        hs.n_bits += 8;
+    }
+
+    hs.n_bits -= n;
+    *value = (hs.bits >> hs.n_bits) & ((1 << n) - 1);
+
+    return true;
+}
+
+static int16_t hs_read (void)
+{
+    uint8_t c;
+    uint_fast16_t value;
+
+    while(hs.count == 0) {
+
+        switch(hs.state) {
+
+            case HS_Tag:
+                if(!hs_get_bits(1, &value))
+                    return SERIAL_NO_DATA;
+                hs.state = value ? HS_Literal : HS_Index;
+                break;
+
+            case HS_Literal:
+                if(!hs_get_bits(8, &value))
+                    return SERIAL_NO_DATA;
+                hs.state = HS_Tag;
+                hs.window[hs.head++ & HS_WINDOW_MASK] = (uint8_t)value;
+                return (int16_t)value;
+
+            case HS_Index:
+                if(!hs_get_bits(LB_HS_WINDOW_BITS, &value))
+                    return SERIAL_NO_DATA;
+                hs.offset = value + 1;
+                hs.state = HS_Count;
+                break;
+
+            default: // HS_Count
+                if(!hs_get_bits(LB_HS_LOOKAHEAD_BITS, &value))
+                    return SERIAL_NO_DATA;
+                hs.count = value + 1;
+                hs.state = HS_Tag;
+                break;
+        }
+    }
+
+    hs.count--;
+    c = hs.window[(hs.head - hs.offset) & HS_WINDOW_MASK];
+    hs.window[hs.head++ & HS_WINDOW_MASK] = c;
+
+    return (int16_t)c;
+}
+
+// Reads the start of the file until it is known to be compressed, start with a UTF-8 BOM or neither.
+static void hs_detect (void)
+{
+    int16_t c;
+
+    while(hs.state == HS_Detect && (c = file_read()) >= 0) {
+
+        hs.header[hs.n_header++] = (uint8_t)c;
+
+        if(hs.n_header == sizeof(utf8_bom) && !memcmp(hs.header, utf8_bom, sizeof(utf8_bom))) {
+            hs.n_header = 0;
+            hs.state = HS_Plain;
+        } else if(hs.n_header == sizeof(hs_magic) && !memcmp(hs.header, hs_magic, sizeof(hs_magic))) {
+            hs.n_header = 0;
+            hs.state = HS_Tag;
+        } else if(memcmp(hs.header, hs_magic, hs.n_header) && (hs.n_header > sizeof(utf8_bom) || memcmp(hs.header, utf8_bom, hs.n_header))) {
+            if(hs.n_header == sizeof(hs_magic))
+                report_message("Compressed file window or lookahead size does not match the plugin", Message_Warning);
+            hs.state = HS_Plain;
+        }
+    }
+}
+
+static int16_t file_source (void)
+{
+    if(hs.state == HS_Detect)
+        hs_detect();
+
+    switch(hs.state) {
+
+        case HS_Detect:
+            return SERIAL_NO_DATA;
+
+        case HS_Plain:
+            return hs.replay < hs.n_header ? (int16_t)hs.header[hs.replay++] : file_read();
+
+        default:
+            break;
+    }
+
+    return hs_read();
+}
+
+#endif // LB_COMPRESSED_FILES
+
+#if LB_REPLAY_BUFFER
+
+/*
+  Raster replay, the input lines between M100 P1 and M100 P0 are captured to a buffer.
+  Spaces are removed and line endings are stored as a single LF, cluster lines are kept packed.
+  M100 P2 replays the captured lines, no status is reported for replayed lines unless
+  an error occurs, this stops the replay.
+*/
+
+typedef enum {
+    Replay_Stop = 0,
+    Replay_Capture,
+    Replay_Run
+} replay_cmd_t;
+
+static struct {
+    bool capturing;
+    bool overflow;
+    bool pending;       // replay requested, started on next read
+    bool source;        // decoder input is read from the buffer
+    stream_read_ptr read;
+    uint_fast16_t length;
+    uint_fast16_t line_start;
+    uint_fast16_t pos;
+    char buffer[LB_REPLAY_BUFFER];
+} replay = {0};
+
+static user_mcode_ptrs_t user_mcode;
+
+static void replay_capture (int16_t c)
+{
+    if(c == '\r')
+        c = '\n';
+
+    if(c == ' ' || (c == '\n' && (replay.length == 0 || replay.buffer[replay.length - 1] == '\n')))
+        return;
+
+    if(replay.length == sizeof(replay.buffer)) {
+        replay.capturing = false;
+        replay.overflow = true;
+        return;
+    }
+
+    if(replay.length == 0 || replay.buffer[replay.length - 1] == '\n')
+        replay.line_start = replay.length;
+
+    replay.buffer[replay.length++] = (char)c;
+}
+
+static int16_t capture_read (void)
+{
+    int16_t c = replay.read();
+
+    if(c >= 0 && c != ASCII_CAN && replay.capturing)
+        replay_capture(c);
+
+    return c;
+}
+
+static int16_t replay_read (void)
+{
+    if(replay.pos < replay.length)
+        return (int16_t)replay.buffer[replay.pos++];
+
+#if LB_BLANK_COLLAPSE
+    if(blank.lines == 0) // Keep suppressing status until the collapsed move has been output.
+#endif
+    replay.source = false;
+
+    return SERIAL_NO_DATA;
+}
+
+static inline stream_read_ptr decoder_source (stream_read_ptr read)
+{
+    if(replay.pending) {
+        replay.pending = false;
+        replay.source = true;
+        replay.pos = 0;
+    }
+
+    if(replay.source)
+        return replay_read;
+
+    if(replay.capturing) {
+        replay.read = read;
+        return capture_read;
+    }
+
+    return read;
+}
+
+static void replay_stop (void)
+{
+    replay.capturing = replay.pending = replay.source = false;
+}
+
+static user_mcode_type_t userMCodeCheck (user_mcode_t mcode)
+{
+    return mcode == LB_REPLAY_MCODE
+            ? UserMCode_Normal
+            : (user_mcode.check ? user_mcode.check(mcode) : UserMCode_Unsupported);
+}
+
+static status_code_t userMCodeValidate (parser_block_t *gc_block)
+{
+    status_code_t state = Status_GcodeValueWordMissing;
+
+    if(gc_block->user_mcode == LB_REPLAY_MCODE) {
+        if(gc_block->words.p) {
+            if(gc_block->values.p != (float)Replay_Stop && gc_block->values.p != (float)Replay_Capture && gc_block->values.p != (float)Replay_Run)
+                state = Status_GcodeValueOutOfRange;
+#if LB_CLUSTERS_THREADED
+            else if(!input.file)
+                state = Status_GcodeUnsupportedCommand; // stream is decoded on the second core
+#endif
+            else if(replay.source || (gc_block->values.p == (float)Replay_Run && (replay.capturing || replay.length == 0)))
+                state = Status_InvalidStatement;
+            else {
+                state = Status_OK;
+                gc_block->words.p = Off;
+            }
+        }
+    } else
+        state = Status_Unhandled;
+
+    return state == Status_Unhandled && user_mcode.validate ? user_mcode.validate(gc_block) : state;
+}
+
+static void userMCodeExecute (uint_fast16_t state, parser_block_t *gc_block)
+{
+    if(gc_block->user_mcode == LB_REPLAY_MCODE) {
+
+        if(state != STATE_CHECK_MODE) switch((replay_cmd_t)gc_block->values.p) {
+
+            case Replay_Capture:
+                replay.length = replay.line_start = 0;
+                replay.overflow = false;
+                replay.capturing = true;
+                break;
+
+            case Replay_Stop:
+                if(replay.capturing)
+                    replay.length = replay.line_start; // remove the M100 P0 line
+                replay.capturing = false;
+                if(replay.overflow) {
+                    replay.length = 0;
+                    report_message("Raster replay buffer overflow", Message_Warning);
+                }
+                break;
+
+            case Replay_Run:
+                replay.pending = true;
+                break;
+        }
+    } else if(user_mcode.execute)
+        user_mcode.execute(state, gc_block);
+}
+
+#else
+#define decoder_source(read) (read)
+#endif // LB_REPLAY_BUFFER
+
+static int16_t file_decoder (void)
+{
+#if LB_COMPRESSED_FILES
+    return decode(decoder_source(file_source));
+#else
+    return decode(decoder_source(file_read));
+#endif
+}
+
+// "Normal" stream decoder
+
+#if LB_CLUSTERS_THREADED
+static int16_t source_read (void);
+#endif
+
+static int16_t stream_decoder (void)
+{
+#if LB_CLUSTERS_THREADED
+    return decode(source_read);
+#else
+    return decode(decoder_source(stream_read));
+#endif
+}
+
+static void decoder_reset (bool clear_modal)
+{
+    if(clear_modal)
+        memset(&modal, 0, sizeof(modal));
+
+    input.s = NULL;
+    input.passthru = false;
+    input.buffering = true;
+    cluster.count = cluster.next = input.length = 0;
+    input.suppress = scan.held = false;
+    scan.pending = 0.0f;
+#if LB_BLANK_COLLAPSE
+    blank_reset();
+#endif
+}
+
+#if LB_CLUSTERS_THREADED
+
+/*
+  The "normal" stream is decoded on the second core. Input is read from the stream by the core
+  and passed to the decoder via a single producer, single consumer queue so that the driver
+  stream functions are only called from the core running the driver. Decoded characters are
+  passed back to the core via a second queue. The head index of a queue is only written by
+  its producer and the tail index only by its consumer.
+  The line end of each line carries the number of status responses to send for it, and a flag
+  for cluster sub-moves that are followed by more sub-moves from the same cluster line.
+  The core resets the decoder by incrementing the generation counter, entries queued by
+  the decoder before it has seen the new generation are discarded.
+  On a soft reset the decoder is stopped until the core has flushed the input stream and reads
+  from it again, so it does not decode input that is to be discarded.
+  File streams are decoded by the core as the file stream may change the stream on end of file.
+*/
+
+#include <stdatomic.h>
+
+#if defined(ESP_PLATFORM)
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#elif defined(PICO_RP2040) || defined(RP2040)
+#include "pico/multicore.h"
+#elif defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#include <sched.h>
+#else
+#error "LB_CLUSTERS_THREADED is not supported for this processor!"
+#endif
+
+#define LB_GEN_MASK 0x7F
+
+typedef struct {
+    uint32_t c    :8,
+             gen  :7,   // generation at the time of decoding
+             more :1,   // line end of cluster sub-move followed by more sub-moves
+             oks  :16;  // number of status responses for the line, line ends only
+} ring_entry_t;
+
+static struct {
+    ring_entry_t data[LB_RING_SIZE];
+    atomic_uint head;           // written by the decoder
+    atomic_uint tail;           // written by the core
+    atomic_uint generation;     // written by the core
+    atomic_uint ack;            // written by the decoder, last generation seen
+    atomic_bool active;         // written by the core
+#if defined(ESP_PLATFORM)
+    atomic_bool waiting;        // written by both, set by the decoder when waiting for a notification
+#endif
+} ring = {0};
+
+static struct {
+    uint8_t data[LB_RING_SIZE];
+    atomic_uint head;           // written by the core
+    atomic_uint tail;           // written by the decoder, and by the core when the decoder is stopped
+} raw = {0};
+
+#if defined(ESP_PLATFORM)
+static TaskHandle_t decoder_handle = NULL;
+#endif
+
+// Core side
+static struct {
+    uint_fast8_t gen;
+    uint_fast16_t oks;
+    bool more;
+    bool skip;  // skip remaining sub-moves of cluster after error
+    bool parked; // decoder stopped by reset, restarted on the next read
+} consumer = { .oks = 1 };
+
+static bool source_empty;
+
+// Decoder side, reads input queued by the core.
+static int16_t source_read (void)
+{
+    int16_t c = SERIAL_NO_DATA;
+    uint_fast32_t tail = atomic_load_explicit(&raw.tail, memory_order_relaxed);
+
+    if(!(source_empty = tail == atomic_load_explicit(&raw.head, memory_order_acquire))) {
+        c = raw.data[tail & (LB_RING_SIZE - 1)];
+        atomic_store_explicit(&raw.tail, tail + 1, memory_order_release);
+    }
+
+    return c;
+}
+
+// Core side, queues input for the decoder. Returns true if any was queued.
+static bool source_fill (void)
+{
+    int16_t c;
+    uint_fast32_t head = atomic_load_explicit(&raw.head, memory_order_relaxed), start = head;
+
+    while(head - atomic_load_explicit(&raw.tail, memory_order_acquire) < LB_RING_SIZE && (c = stream_read()) != SERIAL_NO_DATA)
+        raw.data[head++ & (LB_RING_SIZE - 1)] = (uint8_t)c;
+
+    if(head != start)
+        atomic_store_explicit(&raw.head, head, memory_order_release);
+
+    return head != start;
+}
+
+// Number of status responses to send for the line just decoded.
+static uint_fast16_t line_oks (void)
+{
+#if LB_BLANK_COLLAPSE
+    uint_fast16_t oks;
+
+    if((oks = blank.oks)) {
+        blank.oks = 0;
+        return oks;
+    }
+#endif
+
+    if(input.suppress) {
+        input.suppress = false;
+        return 0;
+    }
+
+    return cluster.count ? 0 : 1;
+}
+
+// The ESP32 decoder task blocks until notified by the core, with a one tick timeout as a fallback.
+static inline void decoder_idle (void)
+{
+#if defined(ESP_PLATFORM)
+    atomic_store_explicit(&ring.waiting, true, memory_order_release);
+    ulTaskNotifyTake(pdTRUE, 1);
+    atomic_store_explicit(&ring.waiting, false, memory_order_relaxed);
+#elif defined(PICO_RP2040) || defined(RP2040)
+    tight_loop_contents();
+#else
+    sched_yield();
+#endif
+}
+
+// Called by the core when the decoder may have work to do.
+static inline void decoder_wake (void)
+{
+#if defined(ESP_PLATFORM)
+    if(atomic_exchange_explicit(&ring.waiting, false, memory_order_acq_rel))
+        xTaskNotifyGive(decoder_handle);
+#endif
+}
+
+// Decoder core main loop
+static void decoder_run (void)
+{
+    int16_t c;
+    bool active;
+    ring_entry_t entry;
+    uint_fast32_t head, gen;
+
+    while(true) {
+
+        // The core sets active after changing the generation on start and clears it before on stop.
+        // Active is loaded first so entries are never tagged with a generation older than active.
+        active = atomic_load_explicit(&ring.active, memory_order_acquire);
+
+        if((gen = atomic_load_explicit(&ring.generation, memory_order_acquire)) != atomic_load_explicit(&ring.ack, memory_order_relaxed)) {
+            decoder_reset(false);
+            atomic_store_explicit(&ring.ack, gen, memory_order_release);
+            continue; // reload active, it may have been cleared before the generation was changed
+        }
+
+        if(!active) {
+            decoder_idle();
+            continue;
+        }
+
+        head = atomic_load_explicit(&ring.head, memory_order_relaxed);
+        if(head - atomic_load_explicit(&ring.tail, memory_order_acquire) >= LB_RING_SIZE) {
+            decoder_idle();
+            continue;
+        }
+
+        source_empty = false;
+
+        if((c = stream_decoder()) < 0) {
+            if(source_empty)
+                decoder_idle();
+            continue;
+        }
+
+        entry.c = (uint8_t)c;
+        entry.gen = gen & LB_GEN_MASK;
+        if(c == '\n' || c == '\r') {
+            entry.more = cluster.count != 0;
+            entry.oks = line_oks();
+        } else {
+            entry.more = 0;
+            entry.oks = 0;
+        }
+
+        ring.data[head & (LB_RING_SIZE - 1)] = entry;
+        atomic_store_explicit(&ring.head, head + 1, memory_order_release);
+    }
+}
+
+#if defined(ESP_PLATFORM)
+
+static void decoder_task (void *arg)
+{
+    decoder_run();
+}
+
+#elif defined(PICO_RP2040) || defined(RP2040)
+
+static void decoder_task (void)
+{
+    decoder_run();
+}
+
+#else
+
+static void *decoder_task (void *arg)
+{
+    decoder_run();
+
+    return NULL;
+}
+
+#endif
+
+static bool decoder_start (void)
+{
+#if defined(ESP_PLATFORM)
+    return xTaskCreatePinnedToCore(decoder_task, "LB clusters", 4096, NULL, 1, &decoder_handle, xPortGetCoreID() ? 0 : 1) == pdPASS;
+#elif defined(PICO_RP2040) || defined(RP2040)
+    multicore_launch_core1(decoder_task);
+    return true;
+#else
+    pthread_t thread;
+    return pthread_create(&thread, NULL, decoder_task, NULL) == 0;
+#endif
+}
+
+// Resets the decoder, does not wait for it to complete.
+static void threaded_reset (void)
+{
+    uint_fast32_t gen = atomic_load_explicit(&ring.generation, memory_order_relaxed) + 1;
+
+    consumer.gen = gen & LB_GEN_MASK;
+    consumer.oks = 1;
+    consumer.more = consumer.skip = consumer.parked = false;
+
+    atomic_store_explicit(&ring.generation, gen, memory_order_release);
+
+    decoder_wake();
+}
+
+// Stops the decoder and waits until it has released the decoder state.
+static void threaded_stop (void)
+{
+    atomic_store_explicit(&ring.active, false, memory_order_release);
+    threaded_reset();
+
+    while(atomic_load_explicit(&ring.ack, memory_order_acquire) != atomic_load_explicit(&ring.generation, memory_order_relaxed));
+
+    atomic_store_explicit(&ring.tail, atomic_load_explicit(&ring.head, memory_order_acquire), memory_order_release);
+    atomic_store_explicit(&raw.tail, atomic_load_explicit(&raw.head, memory_order_relaxed), memory_order_release);
+}
+
+static void threaded_start (void)
+{
+    threaded_reset();
+    atomic_store_explicit(&ring.active, true, memory_order_release);
+    decoder_wake();
+}
+
+static int16_t threaded_read (void)
+{
+    ring_entry_t entry;
+    uint_fast32_t tail;
+
+    if(consumer.parked) {
+        if(ABORTED)
+            return SERIAL_NO_DATA;
+        threaded_start();
+    }
+
+    if(source_fill())
+        decoder_wake();
+
+    tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+
+    while(tail != atomic_load_explicit(&ring.head, memory_order_acquire)) {
+
+        entry = ring.data[tail & (LB_RING_SIZE - 1)];
+        atomic_store_explicit(&ring.tail, ++tail, memory_order_release);
+
+        if(entry.gen != consumer.gen)
+            continue; // queued before reset
+
+        if(entry.c == ASCII_CAN)
+            consumer.skip = false;
+        else if(entry.c == '\n' || entry.c == '\r') {
+            if(consumer.skip) {
+                consumer.skip = entry.more;
+                continue;
+            }
+            consumer.oks = entry.oks;
+            consumer.more = entry.more;
+        } else if(consumer.skip)
+            continue;
+
+        return (int16_t)entry.c;
+    }
+
+    decoder_wake();
+
+    return SERIAL_NO_DATA;
+}
+
+#endif // LB_CLUSTERS_THREADED
+
+// Only respond with a single "ok" message for each cluster
+// or terminate cluster unpacking if error status reported.
+static status_code_t cluster_status_message (status_code_t status_code)
 {
+#if LB_REPLAY_BUFFER
+    if(replay.source) {
+        // Suppress status for replayed lines, stop replay on error.
+#if LB_BLANK_COLLAPSE
+        blank.oks = 0;
+#endif
+        input.suppress = false;
+        if(status_code != Status_OK) {
+            status_message(status_code);
+            replay_stop();
+            decoder_reset(false);
+        }
+        return status_code;
+    }
+#endif
+
+#if LB_CLUSTERS_THREADED
+    if(atomic_load_explicit(&ring.active, memory_order_relaxed)) {
+
+        uint_fast16_t oks = consumer.oks;
+
+        consumer.oks = 1;
+
+        if(oks == 0) {
+            if(status_code != Status_OK) {
+                status_message(status_code);
+                consumer.skip = consumer.more;
+            }
+        } else {
+            status_message(status_code);
+            while(--oks)
+                status_message(Status_OK);
+        }
+
+        consumer.more = false;
+
+        return status_code;
+    }
+#endif
+
+#if LB_BLANK_COLLAPSE
+    if(blank.oks) {
+        // Respond for each line collapsed.
+        status_message(status_code);
+        while(--blank.oks)
+            status_message(Status_OK);
+        return status_code;
+    }
+#endif
+
+    if(input.suppress) {
+        input.suppress = false;
+        if(status_code != Status_OK)
+            status_message(status_code);
+        return status_code;
+    }
+
     if(status_code != Status_OK) {
         status_message(status_code);
         if(cluster.next) {
             input.s = NULL;
+            input.passthru = false;
             cluster.count = cluster.next = input.length = 0;
         }
     } else if(cluster.count == 0)
@@ -395,15 +1687,41 @@ static void stream_changed (stream_type_t type)
     if(on_stream_changed)
         on_stream_changed(type);
 
-    if(type == StreamType_File) {
+#if LB_CLUSTERS_THREADED
+    threaded_stop();
+#endif
+
+#if LB_REPLAY_BUFFER
+    if(replay.capturing && replay.length && replay.buffer[replay.length - 1] != '\n')
+        replay.length = replay.line_start; // remove incomplete last line
+    replay_stop();
+#endif
+
+    if((input.file = type == StreamType_File)) {
         file_read = hal.stream.read;
         hal.stream.read = file_decoder;
-    } else if(hal.stream.read != stream_decoder) {
+#if LB_COMPRESSED_FILES
+        hs_reset();
+#endif
+    }
+#if LB_CLUSTERS_THREADED
+    else if(hal.stream.read != threaded_read) {
+        stream_read = hal.stream.read;
+        hal.stream.read = threaded_read;
+    }
+#else
+    else if(hal.stream.read != stream_decoder) {
         stream_read = hal.stream.read;
         hal.stream.read = stream_decoder;
     }
+#endif
 
-    cluster.count = cluster.next = input.length = 0;
+    decoder_reset(false);
+
+#if LB_CLUSTERS_THREADED
+    if(!input.file)
+        threaded_start();
+#endif
 }
 
 static void cluster_reset (void)
@@ -411,7 +1729,18 @@ static void cluster_reset (void)
     if(on_reset)
         on_reset();
 
-    cluster.count = cluster.next = input.length = 0;
+#if LB_REPLAY_BUFFER
+    replay_stop();
+#endif
+
+#if LB_CLUSTERS_THREADED
+    if(atomic_load_explicit(&ring.active, memory_order_relaxed)) {
+        threaded_stop();
+        consumer.parked = true;
+    }
+#endif
+
+    decoder_reset(true);
 }
 
 static void cluster_report (void)
@@ -423,13 +1752,56 @@ static void cluster_report (void)
     grbl.report.status_message = cluster_status_message;
 }
 
+#if LASER_JOB_SUMMARY
+
+static uint32_t job_clusters;
+static laser_job_start_ptr on_job_start;
+static laser_job_report_ptr on_job_report;
+
+static void onJobStart (void)
+{
+    job_clusters = n_clusters;
+
+    if(on_job_start)
+        on_job_start();
+}
+
+static void onJobReport (char *summary)
+{
+    if(n_clusters != job_clusters)
+        laser_job_add(summary, "clusters", uitoa(n_clusters - job_clusters), "");
+
+    if(on_job_report)
+        on_job_report(summary);
+}
+
+#endif
+
+#if LASER_TELEMETRY
+
+static laser_telemetry_sample_ptr on_telemetry_sample;
+
+static void onTelemetrySample (laser_telemetry_t *data)
+{
+    data->clusters = n_clusters;
+#if LB_CLUSTERS_THREADED
+    if(atomic_load_explicit(&ring.active, memory_order_relaxed))
+        data->decoder_queue = (uint16_t)(atomic_load_explicit(&ring.head, memory_order_acquire) - atomic_load_explicit(&ring.tail, memory_order_relaxed));
+#endif
+
+    if(on_telemetry_sample)
+        on_telemetry_sample(data);
+}
+
+#endif
+
 static void report_options (bool newopt)
 {
     if(!newopt) {
         hal.stream.write("[CLUSTER:");
         hal.stream.write(uitoa(LB_CLUSTER_SIZE));
         hal.stream.write("]" ASCII_EOL);
-        hal.stream.write("[PLUGIN:LightBurn clusters v0.06]" ASCII_EOL);
+        hal.stream.write("[PLUGIN:LightBurn clusters v0.16]" ASCII_EOL);
     }
 
     on_report_options(newopt);
@@ -437,6 +1809,13 @@ static void report_options (bool newopt)
 
 void lb_clusters_init (void)
 {
+#if LB_CLUSTERS_THREADED
+    if(!decoder_start()) {
+        protocol_enqueue_foreground_task(report_warning, "LightBurn clusters decoder failed to start!");
+        return;
+    }
+#endif
+
     on_stream_changed = grbl.on_stream_changed;
     grbl.on_stream_changed = stream_changed;
 
@@ -449,6 +1828,31 @@ void lb_clusters_init (void)
     on_report_handlers_init = grbl.on_report_handlers_init;
     grbl.on_report_handlers_init = cluster_report;
 
+#if LB_REPLAY_BUFFER
+    memcpy(&user_mcode, &grbl.user_mcode, sizeof(user_mcode_ptrs_t));
+
+    grbl.user_mcode.check = userMCodeCheck;
+    grbl.user_mcode.validate = userMCodeValidate;
+    grbl.user_mcode.execute = userMCodeExecute;
+#endif
+
+#if LASER_JOB_SUMMARY
+    laser_job_init();
+
+    on_job_start = laser_job.on_start;
+    laser_job.on_start = onJobStart;
+
+    on_job_report = laser_job.on_report;
+    laser_job.on_report = onJobReport;
+#endif
+
+#if LASER_TELEMETRY
+    laser_telemetry_init();
+
+    on_telemetry_sample = laser_telemetry.on_sample;
+    laser_telemetry.on_sample = onTelemetrySample;
+#endif
+
     stream_changed(hal.stream.type);
 }
 
@@ -29,23 +29,85 @@
 #include <string.h>
 
 #include "grbl/hal.h"
+#include "grbl/nvs_buffer.h"
+
+#include "ppi.h"
+#if LASER_JOB_SUMMARY
+#include "laser_job.h"
+#endif
+#if LASER_TELEMETRY
+#include "laser_telemetry.h"
+#endif
+
+#ifndef PPI_CALIBRATION_POINTS
+#define PPI_CALIBRATION_POINTS 10
+#endif
+
+#define PPI_CALIBRATION_LENGTH 80
+#define PPI_LUT_SIZE 64 // number of LUT intervals
+
+typedef enum {
+    PPIMode_Off = 0,
+    PPIMode_On,
+    PPIMode_Dot,    // one pulse at the centre of each pixel, length proportional to power
+    PPIMode_Density, // pulse density proportional to power, sigma-delta modulated
+    PPIMode_Velocity // PWM proportional to actual segment speed, no pulsing
+} ppi_mode_t;
+
+#define PPI_POWER_ONE (1UL << 16) // full power, power values are in Q16 format
 
 typedef struct {
+    ppi_mode_t mode;
     uint_fast16_t ppi;
     float ppi_distance;
     float ppi_pos;
     float next_pos;
     uint_fast16_t pulse_length; // uS
+    volatile uint_fast16_t length; // uS, pulse length output
+    uint_fast16_t pwm_max;
+    uint32_t power;             // Q16
+    uint32_t step_scale;        // Q16, pixels per step
+    volatile uint32_t density;  // Q16, accumulator increment per step
+    uint32_t accumulator;
+    uint_fast16_t pwm;          // programmed PWM value
+    float cycles_nom;           // step timer cycles per step at programmed rate
+    volatile uint64_t pwm_k;    // pwm * cycles_nom
+    float rpm;                  // programmed RPM value
+    void *segment;
+    spindle_ptrs_t *spindle;
+    spindle_ptrs_t *cached;     // spindle the programmed PWM/RPM values are valid for, NULL if invalid
+#if LASER_JOB_SUMMARY || LASER_TELEMETRY
+    volatile uint32_t pulses;   // pulses fired, free running
+#endif
     bool on;
 } laser_ppi_t;
 
 static laser_ppi_t laser = {
+    .mode = PPIMode_Off,
     .ppi = 600.0f,
     .ppi_distance = 25.4f / 600.0f,
     .pulse_length = 1500,
+    .length = 1500,
     .on = false
 };
 
+typedef struct {
+    char calibration[PPI_CALIBRATION_LENGTH + 1];
+} laser_ppi_settings_t;
+
+typedef struct {
+    uint_fast8_t n_points;
+    float in[PPI_CALIBRATION_POINTS];
+    float out[PPI_CALIBRATION_POINTS];
+} ppi_calibration_t;
+
+static nvs_address_t nvs_address;
+static laser_ppi_settings_t ppi_settings;
+static ppi_calibration_t calibration = {0};
+static bool calibrated = false;
+static uint32_t lut_scale;              // Q16, LUT intervals per PWM count
+static uint16_t lut[PPI_LUT_SIZE + 1];  // corrected PWM values
+static uint32_t recip[128]; // 2^24 / (128 + i)
 static user_mcode_ptrs_t user_mcode;
 static on_report_options_ptr on_report_options;
 static void (*stepper_wake_up)(void);
@@ -56,10 +118,19 @@ static on_spindle_selected_ptr on_spindle_selected;
 static on_program_completed_ptr on_program_completed;
 static spindle_update_pwm_ptr spindle_update_pwm;
 static spindle_update_rpm_ptr spindle_update_rpm;
+static spindle_set_state_ptr spindle_set_state;
+
+// In dot mode the first pulse is fired at the centre of the first pixel.
+static inline void ppi_reset (void)
+{
+    laser.ppi_pos = 0.0f;
+    laser.accumulator = 0;
+    laser.next_pos = laser.mode == PPIMode_Dot ? laser.ppi_distance * 0.5f : 0.0f;
+}
 
 static void stepperWakeUp (void)
 {
-    laser.ppi_pos = laser.next_pos = 0.0f;
+    ppi_reset();
 
     stepper_wake_up();
 }
@@ -77,7 +148,12 @@ static void stepperPulseStartPPI (stepper_t *stepper)
             laser.ppi_pos += mm_per_step;
             if(laser.ppi_pos >= laser.next_pos) {
                 laser.next_pos += laser.ppi_distance;
-                pulse_on(laser.pulse_length);
+                if(laser.length) {
+                    pulse_on(laser.length);
+#if LASER_JOB_SUMMARY || LASER_TELEMETRY
+                    laser.pulses++;
+#endif
+                }
             }
         }
     }
@@ -85,36 +161,162 @@ static void stepperPulseStartPPI (stepper_t *stepper)
     stepper_pulse_start(stepper);
 }
 
+// Sigma-delta modulator: fires a pulse each time the accumulator overflows.
+static void stepperPulseStartDensity (stepper_t *stepper)
+{
+    if(laser.on) {
+
+        if(stepper->new_block) {
+            laser.step_scale = (uint32_t)min((float)PPI_POWER_ONE / (stepper->exec_block->steps_per_mm * laser.ppi_distance), (float)(PPI_POWER_ONE - 1));
+            laser.density = (laser.power * laser.step_scale) >> 16;
+        }
+
+        if(stepper->step_outbits.mask && (laser.accumulator += laser.density) >= PPI_POWER_ONE) {
+            laser.accumulator -= PPI_POWER_ONE;
+            pulse_on(laser.pulse_length);
+#if LASER_JOB_SUMMARY || LASER_TELEMETRY
+            laser.pulses++;
+#endif
+        }
+    }
+
+    stepper_pulse_start(stepper);
+}
+
+// Maps a PWM value to the calibrated value by linear interpolation in the LUT.
+static inline uint_fast16_t calibrate (uint_fast16_t pwm)
+{
+    if(calibrated && pwm) {
+        uint32_t pos = (uint32_t)min(pwm, laser.pwm_max) * lut_scale, idx = pos >> 16;
+        pwm = idx >= PPI_LUT_SIZE
+               ? lut[PPI_LUT_SIZE]
+               : (uint_fast16_t)((int32_t)lut[idx] + ((((int32_t)lut[idx + 1] - (int32_t)lut[idx]) * (int32_t)((pos & 0xFFFF) >> 4)) >> 12));
+    }
+
+    return pwm;
+}
+
+// Scales the programmed PWM value by actual/programmed speed on each new segment.
+// The speed ratio is cycles_nom / cycles, the reciprocal is looked up from a table
+// indexed by the 8 most significant bits of the cycle count.
+static void stepperPulseStartVelocity (stepper_t *stepper)
+{
+    if(stepper->new_block) {
+        laser.cycles_nom = stepper->exec_block->programmed_rate > 0.0f
+                            ? (float)hal.f_step_timer * 60.0f / (stepper->exec_block->programmed_rate * stepper->exec_block->steps_per_mm)
+                            : 0.0f;
+        laser.pwm_k = (uint64_t)laser.pwm * (uint64_t)laser.cycles_nom;
+    }
+
+    if(laser.on && stepper->exec_segment && stepper->exec_segment != laser.segment && laser.spindle) {
+
+        uint32_t pwm, cycles = stepper->exec_segment->cycles_per_tick << stepper->exec_segment->amass_level;
+
+        laser.segment = stepper->exec_segment;
+
+        if(cycles && laser.pwm_k) {
+            uint_fast8_t msb = 31 - __builtin_clz(cycles);
+            uint32_t m = msb >= 7 ? cycles >> (msb - 7) : cycles << (7 - msb);
+            pwm = (uint32_t)((laser.pwm_k * recip[m - 128]) >> (17 + msb));
+            spindle_update_pwm(laser.spindle, calibrate(laser.pwm_max ? min(pwm, laser.pwm_max) : pwm));
+        }
+    }
+
+    stepper_pulse_start(stepper);
+}
+
+// In dot and pulse density modes power is set by the pulse length or density only,
+// the laser is driven at full (calibrated) PWM while on.
+static inline bool fixed_pwm (void)
+{
+    return laser.mode == PPIMode_Dot || laser.mode == PPIMode_Density;
+}
+
+static void set_power (uint32_t power)
+{
+    laser.power = min(power, PPI_POWER_ONE);
+
+    if(laser.mode == PPIMode_Dot)
+        laser.length = (uint_fast16_t)((laser.pulse_length * laser.power) >> 16);
+    else
+        laser.density = (laser.power * laser.step_scale) >> 16;
+}
+
+// Updates that does not change the output are dropped, in PPI mode a pulse is only fired
+// when the laser is turned on.
 static void ppiUpdatePWM (spindle_ptrs_t *spindle, uint_fast16_t pwm)
 {
-    if(!laser.on && pwm > 0)
-        laser.ppi_pos = laser.next_pos = 0.0f;
+    bool turn_on;
 
-    laser.on = pwm > 0;
+    if(spindle == laser.cached && pwm == laser.pwm)
+        return;
+
+    if((turn_on = !laser.on && pwm > 0))
+        ppi_reset();
 
-    spindle_update_pwm(spindle, pwm);
-    pulse_on(laser.pulse_length);
+    laser.on = pwm > 0;
+    laser.pwm = pwm;
+    laser.cached = spindle;
+
+    spindle_update_pwm(spindle, calibrate(pwm && laser.pwm_max && fixed_pwm() ? laser.pwm_max : pwm));
+
+    if(laser.mode == PPIMode_Velocity) {
+        laser.spindle = spindle;
+        laser.pwm_k = (uint64_t)pwm * (uint64_t)laser.cycles_nom;
+    } else if(laser.mode >= PPIMode_Dot)
+        set_power(laser.pwm_max ? ((uint32_t)pwm << 16) / laser.pwm_max : PPI_POWER_ONE);
+    else if(turn_on && pulse_on)
+        pulse_on(laser.pulse_length);
 }
 
 static void ppiUpdateRPM (spindle_ptrs_t *spindle, float rpm)
 {
+    if(spindle == laser.cached && rpm == laser.rpm)
+        return;
+
     if(!laser.on && rpm > 0.0f)
-        laser.ppi_pos = laser.next_pos = 0.0f;
+        ppi_reset();
 
     laser.on = rpm > 0.0f;
+    laser.rpm = rpm;
+    laser.cached = spindle;
+
+    if(fixed_pwm()) {
+        set_power(settings.spindle.rpm_max > 0.0f ? (uint32_t)(rpm / settings.spindle.rpm_max * (float)PPI_POWER_ONE) : PPI_POWER_ONE);
+        if(rpm > 0.0f && settings.spindle.rpm_max > 0.0f)
+            rpm = settings.spindle.rpm_max;
+    }
 
     spindle_update_rpm(spindle, rpm);
 }
 
 static bool enable_ppi (bool on)
 {
-    if(!gc_laser_ppi_enable(on ? laser.ppi : 0, laser.pulse_length)) {
+    laser.cached = NULL;
+    laser.length = laser.pulse_length;
+
+    if(!gc_laser_ppi_enable(on && laser.mode != PPIMode_Velocity ? laser.ppi : 0, laser.pulse_length)) {
 
         if(on && stepper_wake_up == NULL) {
             stepper_wake_up = hal.stepper.wake_up;
             hal.stepper.wake_up = stepperWakeUp;
             stepper_pulse_start = hal.stepper.pulse_start;
-            hal.stepper.pulse_start = stepperPulseStartPPI;
+        }
+
+        if(on) switch(laser.mode) {
+
+            case PPIMode_Density:
+                hal.stepper.pulse_start = stepperPulseStartDensity;
+                break;
+
+            case PPIMode_Velocity:
+                laser.segment = NULL;
+                hal.stepper.pulse_start = stepperPulseStartVelocity;
+                break;
+
+            default:
+                hal.stepper.pulse_start = stepperPulseStartPPI;
+                break;
         }
 
         if(!on && stepper_wake_up != NULL) {
@@ -128,6 +330,13 @@ static bool enable_ppi (bool on)
     return on;
 }
 
+static void set_mode (ppi_mode_t mode)
+{
+    laser.mode = mode;
+    if(!enable_ppi(mode != PPIMode_Off && laser.ppi > 0 && laser.pulse_length > 0))
+        laser.mode = PPIMode_Off;
+}
+
 static user_mcode_type_t userMCodeCheck (user_mcode_t mcode)
 {
     return mcode == LaserPPI_Enable || mcode == LaserPPI_Rate || mcode == LaserPPI_PulseLength
@@ -145,8 +354,12 @@ static status_code_t userMCodeValidate (parser_block_t *gc_block)
             if(!hal.driver_cap.laser_ppi_mode)
                 state = Status_GcodeUnsupportedCommand;
             else if(gc_block->words.p) {
-                state = Status_OK;
-                gc_block->words.p = Off;
+                if(gc_block->values.p < 0.0f || gc_block->values.p > (float)PPIMode_Velocity || gc_block->values.p != truncf(gc_block->values.p))
+                    state = Status_GcodeValueOutOfRange;
+                else {
+                    state = Status_OK;
+                    gc_block->words.p = Off;
+                }
             }
             break;
 
@@ -180,7 +393,7 @@ static status_code_t userMCodeValidate (parser_block_t *gc_block)
 
 static void userMCodeExecute (uint_fast16_t state, parser_block_t *gc_block)
 {
-    static bool ppi_on = false;
+    static ppi_mode_t mode = PPIMode_Off;
 
     bool handled = true;
 
@@ -188,19 +401,19 @@ static void userMCodeExecute (uint_fast16_t state, parser_block_t *gc_block)
       switch(gc_block->user_mcode) {
 
         case LaserPPI_Enable:
-            ppi_on = gc_block->values.p != 0.0f;
-            enable_ppi(ppi_on && laser.ppi > 0 && laser.pulse_length > 0);
+            mode = (ppi_mode_t)gc_block->values.p;
+            set_mode(mode);
             break;
 
         case LaserPPI_Rate:
             if((laser.ppi = (uint_fast16_t)gc_block->values.p) != 0)
                 laser.ppi_distance = 25.4f / (float)laser.ppi;
-            enable_ppi(ppi_on && laser.ppi > 0 && laser.pulse_length > 0);
+            set_mode(mode);
             break;
 
         case LaserPPI_PulseLength:
             laser.pulse_length = (uint16_t)gc_block->values.p;
-            enable_ppi(ppi_on && laser.ppi > 0 && laser.pulse_length > 0);
+            set_mode(mode);
             break;
 
         default:
@@ -212,18 +425,171 @@ static void userMCodeExecute (uint_fast16_t state, parser_block_t *gc_block)
         user_mcode.execute(state, gc_block);
 }
 
+// Calibration is entered as a comma separated list of input:output pairs, in percent of max PWM.
+// Inputs must be increasing, 0:0 and 100:100 are implied if not specified.
+static bool calibration_parse (char *s, ppi_calibration_t *cal)
+{
+    float in, out, last = -1.0f;
+    uint_fast8_t cc = 0;
+
+    cal->n_points = 0;
+
+    while(s[cc]) {
+
+        if(cal->n_points == PPI_CALIBRATION_POINTS ||
+            !read_float(s, &cc, &in) || s[cc++] != ':' || !read_float(s, &cc, &out))
+            return false;
+
+        if(in <= last || in > 100.0f || out < 0.0f || out > 100.0f)
+            return false;
+
+        cal->in[cal->n_points] = in / 100.0f;
+        cal->out[cal->n_points++] = out / 100.0f;
+        last = in;
+
+        if(s[cc] == ',')
+            cc++;
+        else if(s[cc])
+            return false;
+    }
+
+    return true;
+}
+
+static void calibration_build (void)
+{
+    uint_fast8_t idx, seg = 0, n = 0;
+    float x, in[PPI_CALIBRATION_POINTS + 2], out[PPI_CALIBRATION_POINTS + 2];
+
+    laser.cached = NULL;
+
+    if(!(calibrated = calibration.n_points && laser.pwm_max))
+        return;
+
+    if(calibration.in[0] > 0.0f) {
+        in[n] = out[n] = 0.0f;
+        n++;
+    }
+
+    memcpy(&in[n], calibration.in, calibration.n_points * sizeof(float));
+    memcpy(&out[n], calibration.out, calibration.n_points * sizeof(float));
+    n += calibration.n_points;
+
+    if(in[n - 1] < 1.0f) {
+        in[n] = out[n] = 1.0f;
+        n++;
+    }
+
+    for(idx = 0; idx <= PPI_LUT_SIZE; idx++) {
+        x = (float)idx / (float)PPI_LUT_SIZE;
+        while(seg < n - 2 && x > in[seg + 1])
+            seg++;
+        if(n == 1 || x <= in[seg])
+            x = out[seg];
+        else
+            x = out[seg] + (out[seg + 1] - out[seg]) * (min(x, in[seg + 1]) - in[seg]) / (in[seg + 1] - in[seg]);
+        lut[idx] = (uint16_t)lroundf(x * (float)laser.pwm_max);
+    }
+
+    lut_scale = ((uint32_t)PPI_LUT_SIZE << 16) / laser.pwm_max;
+}
+
+static status_code_t set_calibration (setting_id_t id, char *value)
+{
+    ppi_calibration_t cal;
+
+    if(strlen(value) > PPI_CALIBRATION_LENGTH || !calibration_parse(value, &cal))
+        return Status_InvalidStatement;
+
+    strcpy(ppi_settings.calibration, value);
+    memcpy(&calibration, &cal, sizeof(ppi_calibration_t));
+    calibration_build();
+
+    return Status_OK;
+}
+
+static char *get_calibration (setting_id_t id)
+{
+    return ppi_settings.calibration;
+}
+
+static const setting_detail_t ppi_settings_detail[] = {
+    { Setting_LaserPWMCalibration, Group_Spindle, "Laser PWM calibration", NULL, Format_String, "x(80)", NULL, "80", Setting_NonCoreFn, set_calibration, get_calibration, NULL }
+};
+
+#ifndef NO_SETTINGS_DESCRIPTIONS
+
+static const setting_descr_t ppi_settings_descr[] = {
+    { Setting_LaserPWMCalibration, "Comma separated list of input:output pairs, in percent of max PWM, for correcting nonlinear laser response. E.g. 10:18,50:62\\n"
+                                   "0:0 and 100:100 are implied if not specified, leave blank to disable." }
+};
+
+#endif
+
+static void ppi_settings_save (void)
+{
+    hal.nvs.memcpy_to_nvs(nvs_address, (uint8_t *)&ppi_settings, sizeof(laser_ppi_settings_t), true);
+}
+
+static void ppi_settings_restore (void)
+{
+    *ppi_settings.calibration = '\0';
+
+    ppi_settings_save();
+}
+
+static void ppi_settings_load (void)
+{
+    if(hal.nvs.memcpy_from_nvs((uint8_t *)&ppi_settings, nvs_address, sizeof(laser_ppi_settings_t), true) != NVS_TransferResult_OK)
+        ppi_settings_restore();
+
+    ppi_settings.calibration[PPI_CALIBRATION_LENGTH] = '\0';
+
+    if(!calibration_parse(ppi_settings.calibration, &calibration))
+        calibration.n_points = 0;
+
+    calibration_build();
+}
+
+// The spindle output is changed outside of the update functions, invalidate the cached values.
+static void ppiSetState (spindle_ptrs_t *spindle, spindle_state_t state, float rpm)
+{
+    laser.cached = NULL;
+
+    if(!state.on)
+        laser.on = false;
+    else if(fixed_pwm() && rpm > 0.0f && settings.spindle.rpm_max > 0.0f) {
+        set_power((uint32_t)(rpm / settings.spindle.rpm_max * (float)PPI_POWER_ONE));
+        rpm = settings.spindle.rpm_max;
+    }
+
+    spindle_set_state(spindle, state, rpm);
+}
+
 static void onSpindleSelected (spindle_ptrs_t *spindle)
 {
-    if((hal.driver_cap.laser_ppi_mode = spindle->cap.laser && spindle->pulse_on != NULL)) {
+    hal.driver_cap.laser_ppi_mode = spindle->cap.laser && spindle->pulse_on != NULL;
+
+    laser.cached = NULL;
+
+    if(spindle->cap.laser) {
 
         pulse_on = spindle->pulse_on;
 
+        if(spindle->set_state) {
+            spindle_set_state = spindle->set_state;
+            spindle->set_state = ppiSetState;
+        }
+        laser.pwm_max = spindle->context.pwm ? spindle->context.pwm->max_value : 0;
+
+        calibration_build();
+
         if(spindle->update_pwm) {
             spindle_update_pwm = spindle->update_pwm;
             spindle->update_pwm = ppiUpdatePWM;
         }
 
-        if(spindle->update_rpm) {
+        if(spindle->update_rpm && hal.driver_cap.laser_ppi_mode) {
             spindle_update_rpm = spindle->update_rpm;
             spindle->update_rpm = ppiUpdateRPM;
         }
@@ -235,7 +601,7 @@ static void onSpindleSelected (spindle_ptrs_t *spindle)
 
 void onParserInit (parser_state_t *gc_state)
 {
-    enable_ppi(false);
+    set_mode(PPIMode_Off);
 
     if(on_parser_init)
         on_parser_init(gc_state);
@@ -244,22 +610,84 @@ void onParserInit (parser_state_t *gc_state)
 void onProgramCompleted (program_flow_t program_flow, bool check_mode)
 {
     if(!check_mode)
-        enable_ppi(false);
+        set_mode(PPIMode_Off);
 
     if(on_program_completed)
         on_program_completed(program_flow, check_mode);
 }
 
+#if LASER_JOB_SUMMARY
+
+static uint32_t job_pulses;
+static laser_job_start_ptr on_job_start;
+static laser_job_report_ptr on_job_report;
+
+static void onJobStart (void)
+{
+    job_pulses = laser.pulses;
+
+    if(on_job_start)
+        on_job_start();
+}
+
+static void onJobReport (char *summary)
+{
+    if(laser.pulses != job_pulses)
+        laser_job_add(summary, "PPI pulses", uitoa(laser.pulses - job_pulses), "");
+
+    if(on_job_report)
+        on_job_report(summary);
+}
+
+#endif
+
+#if LASER_TELEMETRY
+
+static laser_telemetry_sample_ptr on_telemetry_sample;
+
+static void onTelemetrySample (laser_telemetry_t *data)
+{
+    data->ppi_mode = (uint8_t)laser.mode;
+    data->ppi_pulses = laser.pulses;
+    if(laser.cached)
+        data->pwm = (uint16_t)laser.pwm;
+
+    if(on_telemetry_sample)
+        on_telemetry_sample(data);
+}
+
+#endif
+
 static void onReportOptions (bool newopt)
 {
     on_report_options(newopt);
 
     if(!newopt)
-        report_plugin("Laser PPI", "0.08");
+        report_plugin("Laser PPI", "0.15");
 }
 
 void ppi_init (void)
 {
+    static setting_details_t setting_details = {
+        .settings = ppi_settings_detail,
+        .n_settings = sizeof(ppi_settings_detail) / sizeof(setting_detail_t),
+    #ifndef NO_SETTINGS_DESCRIPTIONS
+        .descriptions = ppi_settings_descr,
+        .n_descriptions = sizeof(ppi_settings_descr) / sizeof(setting_descr_t),
+    #endif
+        .save = ppi_settings_save,
+        .load = ppi_settings_load,
+        .restore = ppi_settings_restore
+    };
+
+    uint_fast8_t idx;
+
+    if((nvs_address = nvs_alloc(sizeof(laser_ppi_settings_t))))
+        settings_register(&setting_details);
+
+    for(idx = 0; idx < sizeof(recip) / sizeof(uint32_t); idx++)
+        recip[idx] = (1UL << 24) / (128 + idx);
+
     memcpy(&user_mcode, &grbl.user_mcode, sizeof(user_mcode_ptrs_t));
 
     grbl.user_mcode.check = userMCodeCheck;
@@ -277,6 +705,23 @@ void ppi_init (void)
 
     on_program_completed = grbl.on_program_completed;
     grbl.on_program_completed = onProgramCompleted;
+
+#if LASER_JOB_SUMMARY
+    laser_job_init();
+
+    on_job_start = laser_job.on_start;
+    laser_job.on_start = onJobStart;
+
+    on_job_report = laser_job.on_report;
+    laser_job.on_report = onJobReport;
+#endif
+
+#if LASER_TELEMETRY
+    laser_telemetry_init();
+
+    on_telemetry_sample = laser_telemetry.on_sample;
+    laser_telemetry.on_sample = onTelemetrySample;
+#endif
 }
 
 #endif
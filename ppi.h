@@ -24,6 +24,9 @@
 #ifndef _LASER_PPI_H_
 #define _LASER_PPI_H_
 
+// Plugin setting, not allocated in the core.
+#define Setting_LaserPWMCalibration ((setting_id_t)399)
+
 void ppi_init (void);
 
 #endif
@@ -0,0 +1,49 @@
+/*
+
+  driver.h - host build configuration for the laser plugins
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _SIM_DRIVER_H_
+#define _SIM_DRIVER_H_
+
+// Plugin options are set per test target by the build, see CMakeLists.txt.
+
+#ifndef LB_CLUSTERS_ENABLE
+#define LB_CLUSTERS_ENABLE 0
+#endif
+
+#ifndef LASER_COOLANT_ENABLE
+#define LASER_COOLANT_ENABLE 0
+#endif
+
+#ifndef PPI_ENABLE
+#define PPI_ENABLE 0
+#endif
+
+#ifndef LASER_JOB_SUMMARY
+#define LASER_JOB_SUMMARY 0
+#endif
+
+#ifndef LASER_TELEMETRY
+#define LASER_TELEMETRY 0
+#endif
+
+#endif
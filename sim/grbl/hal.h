@@ -0,0 +1,671 @@
+/*
+
+  hal.h - minimal stand-in for the grblHAL core API, for building the laser plugins on a host
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Only the parts of the core API used by the plugins are declared, names and
+// signatures follow the core. The other grbl/ headers just include this file.
+
+#ifndef _SIM_HAL_H_
+#define _SIM_HAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define On 1
+#define Off 0
+
+#define bit(n) (1UL << (n))
+
+#ifndef LINE_BUFFER_SIZE
+#define LINE_BUFFER_SIZE 257
+#endif
+
+#define STRLEN 80
+
+#define ASCII_LF  '\n'
+#define ASCII_CR  '\r'
+#define ASCII_CAN 0x18
+#define ASCII_EOL "\r\n"
+
+#define SERIAL_NO_DATA -1
+
+#define CAPS(c) ((c >= 'a' && c <= 'z') ? (c & 0x5F) : c)
+
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+
+// Realtime commands
+
+#define CMD_RESET                        0x18
+#define CMD_OVERRIDE_SPINDLE_RESET       0x99
+#define CMD_OVERRIDE_SPINDLE_COARSE_PLUS 0x9A
+#define CMD_OVERRIDE_SPINDLE_COARSE_MINUS 0x9B
+#define CMD_OVERRIDE_SPINDLE_FINE_PLUS   0x9C
+#define CMD_OVERRIDE_SPINDLE_FINE_MINUS  0x9D
+#define CMD_OVERRIDE_SPINDLE_STOP        0x9E
+
+// System state
+
+#define STATE_IDLE         0
+#define STATE_ALARM        bit(0)
+#define STATE_CHECK_MODE   bit(1)
+#define STATE_HOMING       bit(2)
+#define STATE_CYCLE        bit(3)
+#define STATE_HOLD         bit(4)
+#define STATE_JOG          bit(5)
+#define STATE_SAFETY_DOOR  bit(6)
+#define STATE_SLEEP        bit(7)
+#define STATE_ESTOP        bit(8)
+#define STATE_TOOL_CHANGE  bit(9)
+
+#define EXEC_STATUS_REPORT  bit(0)
+#define EXEC_CYCLE_START    bit(1)
+#define EXEC_CYCLE_COMPLETE bit(2)
+#define EXEC_FEED_HOLD      bit(3)
+#define EXEC_STOP           bit(4)
+#define EXEC_RESET          bit(5)
+
+typedef uint_fast16_t sys_state_t;
+
+typedef enum {
+    Status_OK = 0,
+    Status_ExpectedCommandLetter = 1,
+    Status_BadNumberFormat = 2,
+    Status_InvalidStatement = 3,
+    Status_NegativeValue = 4,
+    Status_SettingDisabled = 5,
+    Status_GcodeUnsupportedCommand = 20,
+    Status_GcodeModalGroupViolation = 21,
+    Status_GcodeUndefinedFeedRate = 22,
+    Status_GcodeValueWordMissing = 28,
+    Status_GcodeNoAxisWords = 31,
+    Status_GcodeValueOutOfRange = 38,
+    Status_Unhandled = 253
+} status_code_t;
+
+typedef enum {
+    Alarm_None = 0,
+    Alarm_HardLimit = 1,
+    Alarm_SoftLimit = 2,
+    Alarm_AbortCycle = 3
+} alarm_code_t;
+
+typedef enum {
+    Message_Plain = 0,
+    Message_Info,
+    Message_Warning
+} message_type_t;
+
+typedef enum {
+    Hold_NotHolding = 0,
+    Hold_Complete,
+    Hold_Pending
+} hold_state_t;
+
+typedef enum {
+    ProgramFlow_Running = 0,
+    ProgramFlow_OptionalStop = 1,
+    ProgramFlow_CompletedM2 = 2,
+    ProgramFlow_Paused = 3,
+    ProgramFlow_CompletedM30 = 30
+} program_flow_t;
+
+typedef union {
+    uint32_t all;
+    struct {
+        uint32_t coolant  :1,
+                 spindle  :1,
+                 overrides:1,
+                 unused   :29;
+    };
+} report_tracking_flags_t;
+
+typedef uint_fast16_t override_t;
+
+typedef union {
+    uint8_t value;
+    struct {
+        uint8_t enabled       :1,
+                initiate      :1,
+                restore       :1,
+                restore_cycle :1,
+                unassigned    :4;
+    };
+} spindle_stop_t;
+
+typedef struct {
+    override_t feed_rate;
+    override_t rapid_rate;
+    override_t spindle_rpm;
+    spindle_stop_t spindle_stop;
+} overrides_t;
+
+typedef struct {
+    volatile bool abort;
+    volatile bool cancel;
+    volatile bool reset_pending;
+    hold_state_t holding_state;
+    report_tracking_flags_t report;
+    overrides_t override;
+} system_t;
+
+extern system_t sys;
+
+#define ABORTED (sys.abort || sys.cancel)
+
+// Streams
+
+typedef enum {
+    StreamType_Serial = 0,
+    StreamType_MPG,
+    StreamType_Bluetooth,
+    StreamType_Telnet,
+    StreamType_WebSocket,
+    StreamType_SDCard,
+    StreamType_File = StreamType_SDCard,
+    StreamType_Redirected,
+    StreamType_Null
+} stream_type_t;
+
+typedef int16_t (*stream_read_ptr)(void);
+typedef void (*stream_write_ptr)(const char *s);
+typedef void (*stream_write_n_ptr)(const uint8_t *s, uint16_t length);
+typedef uint16_t (*get_stream_buffer_count_ptr)(void);
+
+typedef struct {
+    stream_type_t type;
+    stream_read_ptr read;
+    stream_write_ptr write;
+    stream_write_n_ptr write_n;
+    get_stream_buffer_count_ptr get_rx_buffer_count;
+} io_stream_t;
+
+// Spindle
+
+typedef union {
+    uint8_t value;
+    struct {
+        uint8_t on      :1,
+                ccw     :1,
+                pwm     :1,
+                unused  :5;
+    };
+} spindle_state_t;
+
+typedef union {
+    uint16_t value;
+    struct {
+        uint16_t variable :1,
+                 direction:1,
+                 laser    :1,
+                 pwm_invert:1,
+                 unused   :12;
+    };
+} spindle_cap_t;
+
+typedef enum {
+    SpindleSpeedMode_RPM = 0,
+    SpindleSpeedMode_CSS
+} spindle_rpm_mode_t;
+
+typedef struct {
+    uint_fast16_t off_value;
+    uint_fast16_t min_value;
+    uint_fast16_t max_value;
+} spindle_pwm_t;
+
+typedef struct spindle_ptrs spindle_ptrs_t;
+
+typedef void (*spindle_set_state_ptr)(spindle_ptrs_t *spindle, spindle_state_t state, float rpm);
+typedef void (*spindle_update_pwm_ptr)(spindle_ptrs_t *spindle, uint_fast16_t pwm);
+typedef void (*spindle_update_rpm_ptr)(spindle_ptrs_t *spindle, float rpm);
+typedef void (*spindle_pulse_on_ptr)(uint_fast16_t pulse_length);
+
+struct spindle_ptrs {
+    spindle_cap_t cap;
+    union {
+        void *data;
+        spindle_pwm_t *pwm;
+    } context;
+    spindle_set_state_ptr set_state;
+    spindle_update_pwm_ptr update_pwm;
+    spindle_update_rpm_ptr update_rpm;
+    spindle_pulse_on_ptr pulse_on;
+};
+
+// Coolant
+
+typedef union {
+    uint8_t value;
+    struct {
+        uint8_t flood :1,
+                mist  :1,
+                unused:6;
+    };
+} coolant_state_t;
+
+typedef void (*coolant_set_state_ptr)(coolant_state_t mode);
+typedef coolant_state_t (*coolant_get_state_ptr)(void);
+
+typedef struct {
+    coolant_set_state_ptr set_state;
+    coolant_get_state_ptr get_state;
+} coolant_ptrs_t;
+
+// Auxiliary ports
+
+typedef enum {
+    Port_Analog = 0,
+    Port_Digital
+} io_port_type_t;
+
+typedef enum {
+    Port_Input = 0,
+    Port_Output
+} io_port_direction_t;
+
+typedef enum {
+    WaitMode_Immediate = 0,
+    WaitMode_Rise,
+    WaitMode_Fall,
+    WaitMode_High,
+    WaitMode_Low
+} wait_mode_t;
+
+typedef enum {
+    IRQ_Mode_None = 0,
+    IRQ_Mode_Rising = 1,
+    IRQ_Mode_Falling = 2,
+    IRQ_Mode_Change = 3
+} pin_irq_mode_t;
+
+typedef struct {
+    struct {
+        uint32_t irq_mode;
+    } cap;
+} xbar_t;
+
+typedef void (*ioport_interrupt_callback_ptr)(uint8_t port, bool state);
+
+typedef struct {
+    uint8_t num_digital_in;
+    uint8_t num_digital_out;
+    uint8_t num_analog_in;
+    uint8_t num_analog_out;
+    int32_t (*wait_on_input)(io_port_type_t type, uint8_t port, wait_mode_t wait_mode, float timeout);
+    xbar_t *(*get_pin_info)(io_port_type_t type, io_port_direction_t dir, uint8_t port);
+    bool (*register_interrupt_handler)(uint8_t port, pin_irq_mode_t irq_mode, ioport_interrupt_callback_ptr interrupt_callback);
+} io_port_t;
+
+uint8_t ioports_available (io_port_type_t type, io_port_direction_t dir);
+bool ioport_claim (io_port_type_t type, io_port_direction_t dir, uint8_t *port, const char *description);
+bool ioport_can_claim_explicit (void);
+
+// Non-volatile storage
+
+typedef uint32_t nvs_address_t;
+
+typedef enum {
+    NVS_TransferResult_Failed = 0,
+    NVS_TransferResult_Busy,
+    NVS_TransferResult_OK
+} nvs_transfer_result_t;
+
+typedef struct {
+    nvs_transfer_result_t (*memcpy_to_nvs)(nvs_address_t dest, uint8_t *source, uint32_t size, bool with_checksum);
+    nvs_transfer_result_t (*memcpy_from_nvs)(uint8_t *dest, nvs_address_t source, uint32_t size, bool with_checksum);
+} nvs_io_t;
+
+nvs_address_t nvs_alloc (size_t size);
+
+// Stepper and planner
+
+typedef union {
+    uint8_t mask;
+    struct {
+        uint8_t x :1,
+                y :1,
+                z :1,
+                unused:5;
+    };
+} axes_signals_t;
+
+typedef struct {
+    float steps_per_mm;
+    float programmed_rate;
+} st_block_t;
+
+typedef struct {
+    uint32_t cycles_per_tick;
+    uint_fast8_t amass_level;
+} segment_t;
+
+typedef struct {
+    bool new_block;
+    st_block_t *exec_block;
+    segment_t *exec_segment;
+    axes_signals_t step_outbits;
+} stepper_t;
+
+typedef struct {
+    void (*wake_up)(void);
+    void (*pulse_start)(stepper_t *stepper);
+} stepper_ptrs_t;
+
+typedef union {
+    uint16_t value;
+    struct {
+        uint16_t rapid_motion :1,
+                 system_motion:1,
+                 unused       :14;
+    };
+} planner_cond_t;
+
+typedef struct {
+    planner_cond_t condition;
+    struct {
+        spindle_state_t state;
+        float rpm;
+    } spindle;
+    float programmed_rate;
+} plan_block_t;
+
+plan_block_t *plan_get_current_block (void);
+float st_get_realtime_rate (void);
+
+// Parser
+
+typedef enum {
+    UserMCode_Ignore = 0,
+    UserMCode_Generic0 = 100,
+    UserMCode_Generic1 = 101,
+    UserMCode_Generic2 = 102,
+    UserMCode_Generic3 = 103,
+    UserMCode_Generic4 = 104,
+    LaserPPI_Enable = 126,
+    LaserPPI_Rate = 127,
+    LaserPPI_PulseLength = 128
+} user_mcode_t;
+
+typedef enum {
+    UserMCode_Unsupported = 0,
+    UserMCode_Normal,
+    UserMCode_NoValueWords
+} user_mcode_type_t;
+
+typedef struct {
+    uint32_t p :1,
+             q :1,
+             s :1,
+             unused:29;
+} parameter_words_t;
+
+typedef struct {
+    float p;
+    float q;
+    float s;
+} gc_values_t;
+
+typedef struct {
+    user_mcode_t user_mcode;
+    bool user_mcode_sync;
+    parameter_words_t words;
+    gc_values_t values;
+} parser_block_t;
+
+typedef struct {
+    float feed_rate;
+} parser_state_t;
+
+typedef user_mcode_type_t (*user_mcode_check_ptr)(user_mcode_t mcode);
+typedef status_code_t (*user_mcode_validate_ptr)(parser_block_t *gc_block);
+typedef void (*user_mcode_execute_ptr)(uint_fast16_t state, parser_block_t *gc_block);
+
+typedef struct {
+    user_mcode_check_ptr check;
+    user_mcode_validate_ptr validate;
+    user_mcode_execute_ptr execute;
+} user_mcode_ptrs_t;
+
+bool gc_laser_ppi_enable (uint_fast16_t ppi, uint_fast16_t pulse_length);
+
+// Settings
+
+typedef enum {
+    Setting_SpindleRPMMax = 30,
+    Setting_SpindleRPMMin = 31,
+    Setting_Mode = 32,
+    Setting_LaserCoolantOnDelay = 378,
+    Setting_LaserCoolantOffDelay = 379,
+    Setting_LaserCoolantMinTemp = 380,
+    Setting_LaserCoolantMaxTemp = 381,
+    Setting_LaserCoolantTempPort = 384,
+    Setting_LaserCoolantOkPort = 385,
+    Setting_SettingsMax
+} setting_id_t;
+
+typedef enum {
+    Group_Root = 0,
+    Group_General,
+    Group_Spindle,
+    Group_Coolant,
+    Group_AuxPorts
+} setting_group_t;
+
+typedef enum {
+    Format_Bool = 0,
+    Format_Bitfield,
+    Format_XBitfield,
+    Format_RadioButtons,
+    Format_AxisMask,
+    Format_Integer,
+    Format_Decimal,
+    Format_String,
+    Format_Password,
+    Format_IPv4,
+    Format_Int8,
+    Format_Int16
+} setting_datatype_t;
+
+typedef enum {
+    Setting_NonCore = 0,
+    Setting_NonCoreFn,
+    Setting_IsExtended,
+    Setting_IsExtendedFn,
+    Setting_IsLegacy,
+    Setting_IsLegacyFn
+} setting_type_t;
+
+typedef union {
+    uint8_t value;
+    struct {
+        uint8_t reboot_required :1,
+                allow_null      :1,
+                subgroups       :1,
+                increment       :4,
+                hidden          :1;
+    };
+} setting_detail_flags_t;
+
+typedef struct setting_detail setting_detail_t;
+
+typedef bool (*is_setting_available_ptr)(const setting_detail_t *setting);
+typedef status_code_t (*setting_set_string_ptr)(setting_id_t id, char *value);
+typedef char *(*setting_get_string_ptr)(setting_id_t id);
+
+struct setting_detail {
+    setting_id_t id;
+    setting_group_t group;
+    const char *name;
+    const char *unit;
+    setting_datatype_t datatype;
+    const char *format;
+    const char *min_value;
+    const char *max_value;
+    setting_type_t type;
+    void *value;
+    void *get_value;
+    is_setting_available_ptr is_available;
+    setting_detail_flags_t flags;
+};
+
+typedef struct {
+    setting_id_t id;
+    const char *description;
+} setting_descr_t;
+
+typedef struct setting_details {
+    const setting_detail_t *settings;
+    uint8_t n_settings;
+    const setting_descr_t *descriptions;
+    uint8_t n_descriptions;
+    void (*save)(void);
+    void (*load)(void);
+    void (*restore)(void);
+    struct setting_details *next;
+} setting_details_t;
+
+typedef struct {
+    struct {
+        float rpm_max;
+        float rpm_min;
+    } spindle;
+} settings_t;
+
+extern settings_t settings;
+
+void settings_register (setting_details_t *details);
+
+// System commands
+
+typedef status_code_t (*sys_command_ptr)(sys_state_t state, char *args);
+
+typedef union {
+    uint8_t value;
+    struct {
+        uint8_t noargs        :1,
+                allow_blocking:1,
+                help_fn       :1,
+                unused        :5;
+    };
+} sys_command_flags_t;
+
+typedef struct {
+    const char *command;
+    sys_command_ptr execute;
+    sys_command_flags_t flags;
+    union {
+        const char *str;
+        const char *(*fn)(const char *command);
+    } help;
+} sys_command_t;
+
+typedef struct sys_commands_str {
+    uint8_t n_commands;
+    const sys_command_t *commands;
+    struct sys_commands_str *next;
+} sys_commands_t;
+
+void system_register_commands (sys_commands_t *commands);
+
+// Core events and handlers
+
+typedef void (*foreground_task_ptr)(void *data);
+
+typedef status_code_t (*status_message_ptr)(status_code_t status_code);
+typedef bool (*enqueue_realtime_command_ptr)(char c);
+typedef void (*on_state_change_ptr)(sys_state_t state);
+typedef void (*on_program_completed_ptr)(program_flow_t program_flow, bool check_mode);
+typedef void (*on_execute_realtime_ptr)(uint_fast16_t state);
+typedef void (*on_realtime_report_ptr)(stream_write_ptr stream_write, report_tracking_flags_t report);
+typedef void (*on_report_options_ptr)(bool newopt);
+typedef void (*on_report_handlers_init_ptr)(void);
+typedef void (*on_reset_ptr)(void);
+typedef void (*on_stream_changed_ptr)(stream_type_t type);
+typedef void (*on_parser_init_ptr)(parser_state_t *gc_state);
+typedef void (*on_spindle_selected_ptr)(spindle_ptrs_t *spindle);
+typedef void (*on_spindle_programmed_ptr)(spindle_ptrs_t *spindle, spindle_state_t state, float rpm, spindle_rpm_mode_t mode);
+
+typedef struct {
+    status_message_ptr status_message;
+} report_t;
+
+typedef struct {
+    report_t report;
+    user_mcode_ptrs_t user_mcode;
+    enqueue_realtime_command_ptr enqueue_realtime_command;
+    on_state_change_ptr on_state_change;
+    on_program_completed_ptr on_program_completed;
+    on_execute_realtime_ptr on_execute_realtime;
+    on_realtime_report_ptr on_realtime_report;
+    on_report_options_ptr on_report_options;
+    on_report_handlers_init_ptr on_report_handlers_init;
+    on_reset_ptr on_reset;
+    on_stream_changed_ptr on_stream_changed;
+    on_parser_init_ptr on_parser_init;
+    on_spindle_selected_ptr on_spindle_selected;
+    on_spindle_programmed_ptr on_spindle_programmed;
+} grbl_t;
+
+extern grbl_t grbl;
+
+typedef struct {
+    uint32_t laser_ppi_mode :1,
+             unused         :31;
+} driver_cap_t;
+
+typedef struct {
+    uint32_t f_step_timer;
+    uint32_t (*get_elapsed_ticks)(void);
+    driver_cap_t driver_cap;
+    io_stream_t stream;
+    io_port_t port;
+    coolant_ptrs_t coolant;
+    nvs_io_t nvs;
+    stepper_ptrs_t stepper;
+} grbl_hal_t;
+
+extern grbl_hal_t hal;
+
+sys_state_t state_get (void);
+void system_set_exec_state_flag (uint_fast16_t flag);
+void system_set_exec_alarm (alarm_code_t code);
+
+bool task_add_delayed (foreground_task_ptr fn, void *data, uint32_t delay_ms);
+void task_delete (foreground_task_ptr fn, void *data);
+bool protocol_enqueue_foreground_task (foreground_task_ptr fn, void *data);
+bool protocol_execute_realtime (void);
+
+void report_message (const char *msg, message_type_t type);
+void report_warning (void *message);
+void report_plugin (const char *name, const char *version);
+
+bool read_float (char *line, uint_fast8_t *char_counter, float *float_ptr);
+char *ftoa (float n, uint8_t decimal_places);
+char *uitoa (uint32_t n);
+
+#endif
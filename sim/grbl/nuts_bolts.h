@@ -0,0 +1,3 @@
+// Part of the host build stand-in for the grblHAL core, see hal.h.
+
+#include "hal.h"
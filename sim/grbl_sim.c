@@ -0,0 +1,924 @@
+/*
+
+  grbl_sim.c - stub core for running the laser plugins on a host
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Provides just enough of the core for the plugins to run: streams, foreground tasks,
+// auxiliary ports, non-volatile storage, settings and a line based stand-in for the
+// protocol loop. Time is simulated and only advances when asked to.
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "sim.h"
+
+#define SIM_INPUT_SIZE 65536
+#define SIM_NVS_SIZE   2048
+#define SIM_N_TASKS    32
+
+grbl_hal_t hal = {0};
+grbl_t grbl = {0};
+system_t sys = {0};
+settings_t settings = {0};
+sim_t sim = {0};
+
+static struct {
+    uint8_t data[SIM_INPUT_SIZE];
+    atomic_size_t head;
+    atomic_size_t tail;
+} input;
+
+static struct {
+    const uint8_t *data;
+    size_t length;
+    size_t pos;
+    io_stream_t serial;
+} file;
+
+typedef struct {
+    foreground_task_ptr fn;
+    void *data;
+    uint32_t due;
+} sim_task_t;
+
+static sim_task_t tasks[SIM_N_TASKS];
+static uint_fast8_t n_tasks = 0;
+
+static uint8_t nvs[SIM_NVS_SIZE];
+static nvs_address_t nvs_top = 0;
+
+static setting_details_t *setting_details[8];
+static uint_fast8_t n_setting_details = 0;
+static sys_commands_t *commands[8];
+static uint_fast8_t n_commands = 0;
+
+static ioport_interrupt_callback_ptr irq_handler[SIM_N_DIN];
+static pin_irq_mode_t irq_mode[SIM_N_DIN];
+static bool claimed[2][SIM_N_DIN];
+static xbar_t pin_info;
+
+static pthread_t core_thread;
+static int failures = 0;
+
+static void log_add (char *log, size_t size, const char *sep, const char *s)
+{
+    if(*log && strlen(log) + strlen(sep) < size - 1)
+        strcat(log, sep);
+    if(strlen(log) + strlen(s) < size - 1)
+        strcat(log, s);
+}
+
+// Core functions
+
+bool read_float (char *line, uint_fast8_t *char_counter, float *float_ptr)
+{
+    char *ptr = line + *char_counter, c;
+    bool negative = false, decimal = false, digits = false;
+    double value = 0.0, scale = 1.0;
+
+    c = *ptr++;
+    if(c == '-' || c == '+') {
+        negative = c == '-';
+        c = *ptr++;
+    }
+
+    while(true) {
+        if(c >= '0' && c <= '9') {
+            digits = true;
+            if(decimal)
+                value += (double)(c - '0') * (scale *= 0.1);
+            else
+                value = value * 10.0 + (double)(c - '0');
+        } else if(c == '.' && !decimal)
+            decimal = true;
+        else
+            break;
+        c = *ptr++;
+    }
+
+    if(!digits)
+        return false;
+
+    *float_ptr = (float)(negative ? -value : value);
+    *char_counter = (uint_fast8_t)(ptr - line - 1);
+
+    return true;
+}
+
+// Same algorithm as the core, output always has a decimal point.
+char *ftoa (float n, uint8_t decimal_places)
+{
+    static char buf[STRLEN];
+
+    bool neg;
+    char *s = buf, digits[12];
+    uint32_t ipart;
+    uint_fast8_t idx, n_digits = 0;
+    float round = 0.5f;
+
+    if((neg = n < 0.0f))
+        n = -n;
+
+    for(idx = 0; idx < decimal_places; idx++)
+        round *= 0.1f;
+
+    n += round;
+    ipart = (uint32_t)n;
+    n -= (float)ipart;
+
+    do {
+        digits[n_digits++] = '0' + ipart % 10;
+    } while((ipart /= 10));
+
+    if(neg)
+        *s++ = '-';
+
+    while(n_digits)
+        *s++ = digits[--n_digits];
+
+    *s++ = '.';
+
+    while(decimal_places--) {
+        n *= 10.0f;
+        *s++ = '0' + (char)(ipart = (uint32_t)n);
+        n -= (float)ipart;
+    }
+
+    *s = '\0';
+
+    return buf;
+}
+
+char *uitoa (uint32_t n)
+{
+    static char buf[12];
+
+    snprintf(buf, sizeof(buf), "%lu", (unsigned long)n);
+
+    return buf;
+}
+
+sys_state_t state_get (void)
+{
+    return sim.state;
+}
+
+void system_set_exec_state_flag (uint_fast16_t flag)
+{
+    sim.exec_flags |= flag;
+}
+
+void system_set_exec_alarm (alarm_code_t code)
+{
+    sim.alarm = code;
+    sim.state = STATE_ALARM;
+}
+
+void report_message (const char *msg, message_type_t type)
+{
+    log_add(sim.messages, sizeof(sim.messages), "|", msg);
+}
+
+void report_warning (void *message)
+{
+    report_message((char *)message, Message_Warning);
+}
+
+void report_plugin (const char *name, const char *version)
+{
+    char buf[80];
+
+    snprintf(buf, sizeof(buf), "[PLUGIN:%s v%s]", name, version);
+    report_message(buf, Message_Plain);
+}
+
+bool task_add_delayed (foreground_task_ptr fn, void *data, uint32_t delay_ms)
+{
+    if(n_tasks == SIM_N_TASKS)
+        return false;
+
+    tasks[n_tasks++] = (sim_task_t){ .fn = fn, .data = data, .due = sim.ms + delay_ms };
+
+    return true;
+}
+
+void task_delete (foreground_task_ptr fn, void *data)
+{
+    uint_fast8_t idx = n_tasks;
+
+    while(idx) {
+        if(tasks[--idx].fn == fn && tasks[idx].data == data) {
+            memmove(&tasks[idx], &tasks[idx + 1], (n_tasks - idx - 1) * sizeof(sim_task_t));
+            n_tasks--;
+        }
+    }
+}
+
+bool protocol_enqueue_foreground_task (foreground_task_ptr fn, void *data)
+{
+    if(n_tasks == SIM_N_TASKS)
+        return false;
+
+    tasks[n_tasks++] = (sim_task_t){ .fn = fn, .data = data, .due = sim.ms };
+
+    return true;
+}
+
+// Tasks are removed before they are run since they may add themselves again.
+static void run_tasks (void)
+{
+    uint_fast8_t idx = 0;
+    sim_task_t task;
+
+    while(idx < n_tasks) {
+        if((int32_t)(sim.ms - tasks[idx].due) >= 0) {
+            task = tasks[idx];
+            memmove(&tasks[idx], &tasks[idx + 1], (n_tasks - idx - 1) * sizeof(sim_task_t));
+            n_tasks--;
+            task.fn(task.data);
+            idx = 0;
+        } else
+            idx++;
+    }
+}
+
+bool protocol_execute_realtime (void)
+{
+    sim_advance(1);
+
+    return !ABORTED;
+}
+
+nvs_address_t nvs_alloc (size_t size)
+{
+    nvs_address_t addr = 0;
+
+    // Address 0 is reserved for the core settings.
+    if(nvs_top == 0)
+        nvs_top = 64;
+
+    if(nvs_top + size <= SIM_NVS_SIZE) {
+        addr = nvs_top;
+        nvs_top += size;
+    }
+
+    return addr;
+}
+
+static nvs_transfer_result_t memcpy_to_nvs (nvs_address_t dest, uint8_t *source, uint32_t size, bool with_checksum)
+{
+    memcpy(&nvs[dest], source, size);
+
+    return NVS_TransferResult_OK;
+}
+
+// Erased storage fails the read so plugins restore their defaults.
+static nvs_transfer_result_t memcpy_from_nvs (uint8_t *dest, nvs_address_t source, uint32_t size, bool with_checksum)
+{
+    uint32_t idx;
+
+    for(idx = 0; idx < size && nvs[source + idx] == 0xFF; idx++);
+
+    if(idx == size)
+        return NVS_TransferResult_Failed;
+
+    memcpy(dest, &nvs[source], size);
+
+    return NVS_TransferResult_OK;
+}
+
+// NVS starts out blank, defaults are restored on registration so that settings
+// changed before sim_start() are applied on top of them.
+void settings_register (setting_details_t *details)
+{
+    setting_details[n_setting_details++] = details;
+
+    if(details->restore)
+        details->restore();
+}
+
+void system_register_commands (sys_commands_t *cmds)
+{
+    commands[n_commands++] = cmds;
+}
+
+uint8_t ioports_available (io_port_type_t type, io_port_direction_t dir)
+{
+    return dir == Port_Input ? (type == Port_Digital ? SIM_N_DIN : SIM_N_AIN) : 0;
+}
+
+bool ioport_claim (io_port_type_t type, io_port_direction_t dir, uint8_t *port, const char *description)
+{
+    if(dir != Port_Input || *port >= SIM_N_DIN || claimed[type][*port])
+        return false;
+
+    return (claimed[type][*port] = true);
+}
+
+bool ioport_can_claim_explicit (void)
+{
+    return true;
+}
+
+bool gc_laser_ppi_enable (uint_fast16_t ppi, uint_fast16_t pulse_length)
+{
+    return false;
+}
+
+plan_block_t *plan_get_current_block (void)
+{
+    return sim.block;
+}
+
+float st_get_realtime_rate (void)
+{
+    return sim.realtime_rate;
+}
+
+// HAL
+
+static uint32_t get_elapsed_ticks (void)
+{
+    return sim.ms;
+}
+
+static int16_t serial_read (void)
+{
+    if(!pthread_equal(pthread_self(), core_thread))
+        sim.foreign_read = true;
+
+    size_t tail = atomic_load_explicit(&input.tail, memory_order_relaxed);
+
+    if(tail == atomic_load_explicit(&input.head, memory_order_acquire))
+        return SERIAL_NO_DATA;
+
+    int16_t c = input.data[tail % SIM_INPUT_SIZE];
+
+    atomic_store_explicit(&input.tail, tail + 1, memory_order_release);
+
+    return c;
+}
+
+static uint16_t serial_rx_count (void)
+{
+    return (uint16_t)(atomic_load(&input.head) - atomic_load(&input.tail));
+}
+
+static void serial_write (const char *s)
+{
+}
+
+static void serial_write_n (const uint8_t *s, uint16_t length)
+{
+    while(length-- && sim.output_length < sizeof(sim.output))
+        sim.output[sim.output_length++] = *s++;
+}
+
+static bool input_pending (void)
+{
+    return hal.stream.type == StreamType_File ? file.pos < file.length : atomic_load(&input.head) != atomic_load(&input.tail);
+}
+
+static int16_t file_read (void)
+{
+    return file.pos < file.length ? file.data[file.pos++] : SERIAL_NO_DATA;
+}
+
+static int32_t wait_on_input (io_port_type_t type, uint8_t port, wait_mode_t wait_mode, float timeout)
+{
+    if(type == Port_Analog)
+        return port < SIM_N_AIN ? sim.ain[port] : -1;
+
+    if(port >= SIM_N_DIN)
+        return -1;
+
+    if(wait_mode == WaitMode_High && !sim.din[port]) {
+        sim_advance((uint32_t)(timeout * 1000.0f));
+        return -1;
+    }
+
+    return sim.din[port] ? 1 : 0;
+}
+
+static xbar_t *get_pin_info (io_port_type_t type, io_port_direction_t dir, uint8_t port)
+{
+    pin_info.cap.irq_mode = sim.irq_caps;
+
+    return type == Port_Digital && dir == Port_Input && port < SIM_N_DIN ? &pin_info : NULL;
+}
+
+static bool register_interrupt_handler (uint8_t port, pin_irq_mode_t mode, ioport_interrupt_callback_ptr callback)
+{
+    if(port >= SIM_N_DIN || (mode & ~sim.irq_caps))
+        return false;
+
+    irq_mode[port] = mode;
+    irq_handler[port] = callback;
+
+    return true;
+}
+
+static void coolant_set_state (coolant_state_t mode)
+{
+    sim.coolant = mode;
+}
+
+static coolant_state_t coolant_get_state (void)
+{
+    return sim.coolant;
+}
+
+static void stepper_wake_up (void)
+{
+}
+
+static void stepper_pulse_start (stepper_t *stepper)
+{
+}
+
+// Stepper driver loop, steps are 0.01 mm.
+
+static st_block_t st_block = { .steps_per_mm = 100.0f };
+static segment_t st_segment = {0};
+static stepper_t stepper = { .exec_block = &st_block, .exec_segment = &st_segment };
+
+// Runs a move of the X axis as the step interrupt of a driver does, the block is
+// flagged as new on the first step. Returns the number of laser pulses fired.
+uint32_t sim_step (float distance, float rate)
+{
+    uint32_t steps = (uint32_t)(distance * st_block.steps_per_mm), pulses = sim.pulses;
+
+    st_block.programmed_rate = rate;
+    stepper.step_outbits.x = On;
+    stepper.new_block = true;
+
+    hal.stepper.wake_up();
+
+    while(steps--) {
+        hal.stepper.pulse_start(&stepper);
+        stepper.new_block = false;
+    }
+
+    stepper.step_outbits.x = Off;
+
+    return sim.pulses - pulses;
+}
+
+static void spindle_set_state (spindle_ptrs_t *spindle, spindle_state_t state, float rpm)
+{
+    sim.rpm = state.on ? rpm : 0.0f;
+}
+
+static void spindle_update_pwm (spindle_ptrs_t *spindle, uint_fast16_t pwm)
+{
+    sim.pwm_value = pwm;
+}
+
+static void spindle_update_rpm (spindle_ptrs_t *spindle, float rpm)
+{
+    sim.rpm = rpm;
+}
+
+static void spindle_pulse_on (uint_fast16_t pulse_length)
+{
+    sim.pulses++;
+    sim.pulse_length = pulse_length;
+}
+
+// Core handlers at the end of the plugin chains
+
+static status_code_t status_message (status_code_t status_code)
+{
+    char buf[16];
+
+    if(status_code == Status_OK)
+        strcpy(buf, "ok");
+    else
+        snprintf(buf, sizeof(buf), "error:%d", (int)status_code);
+
+    log_add(sim.status, sizeof(sim.status), " ", buf);
+
+    return status_code;
+}
+
+static bool enqueue_realtime_command (char c)
+{
+    char buf[8];
+
+    snprintf(buf, sizeof(buf), "%02X", (uint8_t)c);
+    log_add(sim.realtime, sizeof(sim.realtime), " ", buf);
+
+    switch((uint8_t)c) {
+
+        case CMD_OVERRIDE_SPINDLE_RESET:
+            sys.override.spindle_rpm = 100;
+            break;
+
+        case CMD_OVERRIDE_SPINDLE_FINE_PLUS:
+            if(sys.override.spindle_rpm < 200)
+                sys.override.spindle_rpm++;
+            break;
+
+        case CMD_OVERRIDE_SPINDLE_FINE_MINUS:
+            if(sys.override.spindle_rpm > 10)
+                sys.override.spindle_rpm--;
+            break;
+
+        case CMD_OVERRIDE_SPINDLE_STOP:
+            sim.spindle_stopped = !sim.spindle_stopped;
+            sys.override.spindle_stop.enabled = sim.spindle_stopped;
+            break;
+    }
+
+    return true;
+}
+
+static user_mcode_type_t user_mcode_check (user_mcode_t mcode)
+{
+    return UserMCode_Unsupported;
+}
+
+static void on_execute_realtime (uint_fast16_t state)
+{
+}
+
+static void on_report_options (bool newopt)
+{
+}
+
+static void on_report_handlers_init (void)
+{
+    grbl.report.status_message = status_message;
+}
+
+// Simulation control
+
+void sim_init (void)
+{
+    memset(nvs, 0xFF, sizeof(nvs));
+
+    core_thread = pthread_self();
+
+    hal.f_step_timer = 1000000;
+    hal.get_elapsed_ticks = get_elapsed_ticks;
+    hal.stream.type = StreamType_Serial;
+    hal.stream.read = serial_read;
+    hal.stream.write = serial_write;
+    hal.stream.write_n = serial_write_n;
+    hal.stream.get_rx_buffer_count = serial_rx_count;
+    hal.port.num_digital_in = SIM_N_DIN;
+    hal.port.num_analog_in = SIM_N_AIN;
+    hal.port.wait_on_input = wait_on_input;
+    hal.port.get_pin_info = get_pin_info;
+    hal.port.register_interrupt_handler = register_interrupt_handler;
+    hal.coolant.set_state = coolant_set_state;
+    hal.coolant.get_state = coolant_get_state;
+    hal.nvs.memcpy_to_nvs = memcpy_to_nvs;
+    hal.nvs.memcpy_from_nvs = memcpy_from_nvs;
+    hal.stepper.wake_up = stepper_wake_up;
+    hal.stepper.pulse_start = stepper_pulse_start;
+
+    grbl.report.status_message = status_message;
+    grbl.enqueue_realtime_command = enqueue_realtime_command;
+    grbl.user_mcode.check = user_mcode_check;
+    grbl.on_execute_realtime = on_execute_realtime;
+    grbl.on_report_options = on_report_options;
+    grbl.on_report_handlers_init = on_report_handlers_init;
+
+    sys.override.spindle_rpm = 100;
+    settings.spindle.rpm_max = 1000.0f;
+
+    sim.irq_caps = IRQ_Mode_Rising|IRQ_Mode_Falling;
+    sim.pwm.max_value = 1000;
+    sim.spindle.cap.variable = sim.spindle.cap.laser = On;
+    sim.spindle.context.pwm = &sim.pwm;
+    sim.spindle.set_state = spindle_set_state;
+    sim.spindle.update_pwm = spindle_update_pwm;
+    sim.spindle.update_rpm = spindle_update_rpm;
+    sim.spindle.pulse_on = spindle_pulse_on;
+}
+
+// Called after the plugins are initialized, loads settings like the core does on startup.
+void sim_start (void)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < n_setting_details; idx++) {
+        if(setting_details[idx]->load)
+            setting_details[idx]->load();
+    }
+
+    grbl.on_report_handlers_init();
+    grbl.on_report_options(false);
+}
+
+void sim_advance (uint32_t ms)
+{
+    run_tasks();
+
+    while(ms--) {
+        sim.ms++;
+        run_tasks();
+        grbl.on_execute_realtime(sim.state);
+    }
+}
+
+// Soft reset, pending input is flushed.
+void sim_reset (void)
+{
+    sys.abort = true;
+
+    if(grbl.on_reset)
+        grbl.on_reset();
+
+    atomic_store(&input.tail, atomic_load(&input.head));
+
+    sys.abort = false;
+}
+
+void sim_input_n (const uint8_t *data, size_t length)
+{
+    size_t head = atomic_load_explicit(&input.head, memory_order_relaxed);
+
+    while(length--)
+        input.data[head++ % SIM_INPUT_SIZE] = *data++;
+
+    atomic_store_explicit(&input.head, head, memory_order_release);
+}
+
+void sim_input (const char *data)
+{
+    sim_input_n((const uint8_t *)data, strlen(data));
+}
+
+void sim_file_open (const uint8_t *data, size_t length)
+{
+    file.data = data;
+    file.length = length;
+    file.pos = 0;
+    memcpy(&file.serial, &hal.stream, sizeof(io_stream_t));
+
+    hal.stream.type = StreamType_File;
+    hal.stream.read = file_read;
+    hal.stream.get_rx_buffer_count = NULL;
+
+    if(grbl.on_stream_changed)
+        grbl.on_stream_changed(StreamType_File);
+}
+
+void sim_file_close (void)
+{
+    memcpy(&hal.stream, &file.serial, sizeof(io_stream_t));
+
+    if(grbl.on_stream_changed)
+        grbl.on_stream_changed(hal.stream.type);
+}
+
+static uint64_t wall_us (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Reads lines from the stream and executes them like the core protocol loop until the
+// input is exhausted. With the threaded decoder, waits until it has gone quiet.
+uint_fast16_t sim_run (sim_execute_ptr execute)
+{
+    char line[LINE_BUFFER_SIZE];
+    int16_t c;
+    uint_fast16_t length = 0, n_lines = 0, idle = 0;
+    uint64_t quiet = 0;
+
+    if(execute == NULL)
+        execute = sim_execute;
+
+    while(true) {
+
+        if((c = hal.stream.read()) == SERIAL_NO_DATA) {
+            if(input_pending())
+                continue;
+            if(sim.threaded) {
+                if(quiet == 0)
+                    quiet = wall_us();
+                else if(wall_us() - quiet > 50000)
+                    break;
+                usleep(10);
+            } else if(++idle > 8)
+                break;
+            continue;
+        }
+
+        idle = 0;
+        quiet = 0;
+
+        if(c == ASCII_LF || c == ASCII_CR) {
+            line[length] = '\0';
+            log_add(sim.lines, sizeof(sim.lines), "|", line);
+            grbl.report.status_message(length ? execute(line) : Status_OK);
+            length = 0;
+            n_lines++;
+        } else if(length < LINE_BUFFER_SIZE - 1)
+            line[length++] = (char)c;
+    }
+
+    return n_lines;
+}
+
+// Executes user M-codes and reports program end, other lines are accepted as is.
+status_code_t sim_execute (char *line)
+{
+    status_code_t status = Status_OK;
+    uint_fast8_t cc = 1;
+    float value;
+
+    if(*line == 'M' && read_float(line, &cc, &value)) {
+
+        user_mcode_t mcode = (user_mcode_t)value;
+
+        if(mcode == 2 || mcode == 30) {
+            if(grbl.on_program_completed)
+                grbl.on_program_completed(mcode == 2 ? ProgramFlow_CompletedM2 : ProgramFlow_CompletedM30, false);
+        } else if(grbl.user_mcode.check(mcode) != UserMCode_Unsupported) {
+
+            parser_block_t block = { .user_mcode = mcode };
+
+            while(line[cc]) {
+                char letter = line[cc++];
+                if(!read_float(line, &cc, &value))
+                    return Status_BadNumberFormat;
+                switch(letter) {
+                    case 'P': block.words.p = On; block.values.p = value; break;
+                    case 'Q': block.words.q = On; block.values.q = value; break;
+                    case 'S': block.words.s = On; block.values.s = value; break;
+                    default: return Status_GcodeUnsupportedCommand;
+                }
+            }
+
+            if((status = grbl.user_mcode.validate(&block)) == Status_OK)
+                grbl.user_mcode.execute(sim.state, &block);
+        }
+    }
+
+    return status;
+}
+
+status_code_t sim_setting (setting_id_t id, char *value)
+{
+    uint_fast8_t idx, n;
+
+    for(idx = 0; idx < n_setting_details; idx++) {
+        for(n = 0; n < setting_details[idx]->n_settings; n++) {
+
+            const setting_detail_t *setting = &setting_details[idx]->settings[n];
+
+            if(setting->id != id)
+                continue;
+
+            if(setting->type == Setting_NonCoreFn)
+                return ((setting_set_string_ptr)setting->value)(id, value);
+
+            switch(setting->datatype) {
+
+                case Format_Decimal:
+                    *(float *)setting->value = strtof(value, NULL);
+                    break;
+
+                case Format_Integer:
+                    *(uint32_t *)setting->value = (uint32_t)strtoul(value, NULL, 10);
+                    break;
+
+                case Format_Int16:
+                    *(uint16_t *)setting->value = (uint16_t)strtoul(value, NULL, 10);
+                    break;
+
+                case Format_String:
+                    strcpy((char *)setting->value, value);
+                    break;
+
+                default:
+                    *(uint8_t *)setting->value = (uint8_t)strtoul(value, NULL, 10);
+                    break;
+            }
+
+            if(setting_details[idx]->save)
+                setting_details[idx]->save();
+
+            return Status_OK;
+        }
+    }
+
+    return Status_Unhandled;
+}
+
+status_code_t sim_command (const char *command, char *args)
+{
+    uint_fast8_t idx, n;
+
+    for(idx = 0; idx < n_commands; idx++) {
+        for(n = 0; n < commands[idx]->n_commands; n++) {
+            if(!strcmp(commands[idx]->commands[n].command, command))
+                return commands[idx]->commands[n].execute(sim.state, args);
+        }
+    }
+
+    return Status_Unhandled;
+}
+
+void sim_din (uint8_t port, bool level)
+{
+    if(port < SIM_N_DIN && sim.din[port] != level) {
+        sim.din[port] = level;
+        if(irq_handler[port] && (irq_mode[port] & (level ? IRQ_Mode_Rising : IRQ_Mode_Falling)))
+            irq_handler[port](port, level);
+    }
+}
+
+void sim_spindle_select (void)
+{
+    if(grbl.on_spindle_selected)
+        grbl.on_spindle_selected(&sim.spindle);
+}
+
+void sim_log_clear (void)
+{
+    *sim.lines = *sim.status = *sim.messages = *sim.realtime = '\0';
+    sim.output_length = 0;
+}
+
+// Test runner
+
+void sim_check (bool ok, const char *expr, const char *file, int line)
+{
+    if(!ok) {
+        failures++;
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+    }
+}
+
+void sim_check_str (const char *actual, const char *expected, const char *file, int line)
+{
+    if(strcmp(actual, expected)) {
+        failures++;
+        fprintf(stderr, "%s:%d: expected \"%s\"\n%s:%d:      got \"%s\"\n", file, line, expected, file, line, actual);
+    }
+}
+
+void sim_test (const char *name, sim_test_ptr test)
+{
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    fflush(stderr);
+
+    if((pid = fork()) == 0) {
+        failures = 0; // Only count the failures of this test.
+        sim_init();
+        test();
+        fflush(stderr);
+        _exit(failures ? 1 : 0);
+    }
+
+    waitpid(pid, &status, 0);
+
+    if(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        printf("pass: %s\n", name);
+    else {
+        failures++;
+        printf("FAIL: %s\n", name);
+    }
+}
+
+int sim_done (void)
+{
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
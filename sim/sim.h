@@ -0,0 +1,95 @@
+/*
+
+  sim.h - stub core for running the laser plugins on a host
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include "grbl/hal.h"
+
+#define SIM_LOG_SIZE 8192
+#define SIM_N_DIN    4
+#define SIM_N_AIN    4
+
+// Called for each line read by sim_run(), returns the status to report.
+typedef status_code_t (*sim_execute_ptr)(char *line);
+
+typedef struct {
+    uint32_t ms;                    // simulated time
+    sys_state_t state;              // returned by state_get()
+    uint_fast16_t exec_flags;       // set by system_set_exec_state_flag()
+    alarm_code_t alarm;             // set by system_set_exec_alarm()
+    bool threaded;                  // input is decoded on another thread, sim_run() waits for it
+    bool foreign_read;              // stream read from another thread than the one running the core
+    char lines[SIM_LOG_SIZE];       // lines read by sim_run(), separated by '|'
+    char status[SIM_LOG_SIZE];      // status responses, "ok" or "error:<n>" separated by spaces
+    char messages[SIM_LOG_SIZE];    // messages, separated by '|'
+    char realtime[256];             // realtime commands enqueued by the plugins
+    uint8_t output[1024];           // binary output written by hal.stream.write_n
+    uint_fast16_t output_length;
+    bool din[SIM_N_DIN];            // digital input levels
+    pin_irq_mode_t irq_caps;        // interrupt modes supported by the digital inputs
+    int32_t ain[SIM_N_AIN];         // analog input values
+    coolant_state_t coolant;        // last state output by hal.coolant.set_state
+    spindle_ptrs_t spindle;         // laser spindle with PWM, see sim_spindle_select()
+    spindle_pwm_t pwm;
+    uint_fast16_t pwm_value;        // last value output by spindle.update_pwm
+    float rpm;                      // last value output by spindle.update_rpm
+    uint32_t pulses;                // pulses output by spindle.pulse_on
+    uint_fast16_t pulse_length;     // length of last pulse, microseconds
+    bool spindle_stopped;           // toggled by CMD_OVERRIDE_SPINDLE_STOP
+    plan_block_t *block;            // returned by plan_get_current_block()
+    float realtime_rate;            // returned by st_get_realtime_rate()
+} sim_t;
+
+extern sim_t sim;
+
+void sim_init (void);
+void sim_start (void);
+void sim_advance (uint32_t ms);
+void sim_reset (void);
+void sim_input (const char *data);
+void sim_input_n (const uint8_t *data, size_t length);
+void sim_file_open (const uint8_t *data, size_t length);
+void sim_file_close (void);
+uint_fast16_t sim_run (sim_execute_ptr execute);
+status_code_t sim_execute (char *line);
+status_code_t sim_setting (setting_id_t id, char *value);
+status_code_t sim_command (const char *command, char *args);
+void sim_din (uint8_t port, bool level);
+void sim_spindle_select (void);
+uint32_t sim_step (float distance, float rate);
+void sim_log_clear (void);
+
+// Test runner, each test is run in a separate process so plugin state starts out fresh.
+
+typedef void (*sim_test_ptr)(void);
+
+void sim_check (bool ok, const char *expr, const char *file, int line);
+void sim_check_str (const char *actual, const char *expected, const char *file, int line);
+void sim_test (const char *name, sim_test_ptr test);
+int sim_done (void);
+
+#define CHECK(expr) sim_check((expr), #expr, __FILE__, __LINE__)
+#define CHECK_STR(actual, expected) sim_check_str((actual), (expected), __FILE__, __LINE__)
+
+#endif
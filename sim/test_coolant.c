@@ -0,0 +1,390 @@
+/*
+
+  test_coolant.c - host tests for the laser coolant plugin
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Ports are assigned the highest numbered inputs by default: coolant ok is digital
+// input 3, coolant temperature analog input 3. Temperatures are input in 0.1 degrees.
+
+#include <string.h>
+
+#include "driver.h"
+#include "sim.h"
+#include "coolant.h"
+
+#define OK_PORT   3
+#define TEMP_PORT 3
+
+static void inputs (void)
+{
+    sim_din(OK_PORT, true);
+    sim.ain[TEMP_PORT] = 200;
+}
+
+static void start (void)
+{
+    laser_coolant_init();
+    sim_start();
+    inputs();
+}
+
+static void coolant (bool on)
+{
+    hal.coolant.set_state((coolant_state_t){ .flood = on });
+}
+
+static void laser (bool on)
+{
+    grbl.on_spindle_programmed(&sim.spindle, (spindle_state_t){ .on = on }, settings.spindle.rpm_max, SpindleSpeedMode_RPM);
+}
+
+static uint_fast16_t count (const char *log, const char *s)
+{
+    uint_fast16_t n = 0;
+
+    while((log = strstr(log, s))) {
+        n++;
+        log += strlen(s);
+    }
+
+    return n;
+}
+
+// Heats at 0.5 degrees per second with the laser on, cools at 1 degree per second when off,
+// returns the number of override steps down.
+static uint_fast16_t run_thermal (bool heat, uint_fast16_t seconds)
+{
+    while(seconds--) {
+        sim.ain[TEMP_PORT] += heat ? 5 : -10;
+        sim_advance(1000);
+    }
+
+    return count(sim.realtime, "9D");
+}
+
+static void derate_start (void)
+{
+    start();
+
+    sim_setting(Setting_LaserCoolantMaxTemp, "30.0");
+    sim_setting(Setting_LaserCoolantForecastTime, "60");
+
+    coolant(true);
+    laser(true);
+    sim.state = STATE_CYCLE;
+
+    CHECK(run_thermal(true, 10) > 0);
+}
+
+static void test_derate (void)
+{
+    uint_fast16_t steps;
+
+    derate_start();
+
+    steps = count(sim.realtime, "9D");
+    sim_log_clear();
+    laser(false);
+    run_thermal(false, 10);
+    CHECK(count(sim.realtime, "9C") == steps);
+}
+
+// The forecast does not depend on how long the machine has been idle before the job.
+static void derate_idle (uint_fast8_t hours)
+{
+    start();
+
+    sim_setting(Setting_LaserCoolantMaxTemp, "30.0");
+    sim_setting(Setting_LaserCoolantForecastTime, "60");
+
+    while(hours--)
+        sim_advance(3600 * 1000);
+
+    coolant(true);
+    laser(true);
+    sim.state = STATE_CYCLE;
+
+    CHECK(run_thermal(true, 10) > 0);
+    CHECK(count(sim.realtime, "9C") == 0);
+}
+
+static void test_derate_idle_3h (void)
+{
+    derate_idle(3);
+}
+
+static void test_derate_idle_6h (void)
+{
+    derate_idle(6);
+}
+
+static void test_derate_user_override (void)
+{
+    derate_start();
+
+    sim_log_clear();
+    grbl.enqueue_realtime_command(CMD_OVERRIDE_SPINDLE_RESET);
+    laser(false);
+    run_thermal(false, 10);
+    CHECK(count(sim.realtime, "9C") == 0);
+}
+
+static void test_derate_program_end (void)
+{
+    derate_start();
+
+    grbl.on_program_completed(ProgramFlow_CompletedM2, false);
+    sim_log_clear();
+    laser(false);
+    run_thermal(false, 10);
+    CHECK(count(sim.realtime, "9C") == 0);
+}
+
+static void test_derate_reset (void)
+{
+    derate_start();
+
+    sim_reset();
+    sim_log_clear();
+    laser(false);
+    run_thermal(false, 10);
+    CHECK(count(sim.realtime, "9C") == 0);
+}
+
+static void test_fault_hold (void)
+{
+    start();
+
+    sim_setting(Setting_LaserCoolantOptions, "2"); // Feed hold on coolant fault
+
+    coolant(true);
+    laser(true);
+    sim.state = STATE_CYCLE;
+
+    sim_din(OK_PORT, false);
+    CHECK(sim.exec_flags & EXEC_FEED_HOLD);
+
+    // Laser is stopped when the hold is complete.
+    sim_advance(20);
+    CHECK(!sim.spindle_stopped);
+    sim.state = STATE_HOLD;
+    sys.holding_state = Hold_Complete;
+    sim_advance(20);
+    CHECK(sim.spindle_stopped);
+
+    // Resumed when coolant is restored, laser is restored by the core.
+    sim_din(OK_PORT, true);
+    sim_advance(2100);
+    CHECK(sim.exec_flags & EXEC_CYCLE_START);
+    CHECK_STR(sim.realtime, "9E");
+}
+
+static void test_fault_idle (void)
+{
+    start();
+
+    sim_setting(Setting_LaserCoolantOptions, "2"); // Feed hold on coolant fault
+
+    coolant(true);
+    sim_din(OK_PORT, false);
+    sim_advance(100);
+    CHECK(sim.alarm == Alarm_AbortCycle);
+}
+
+// A fault raised in a cycle stays latched when the job is stopped, the next cycle is held.
+static void test_fault_latched (void)
+{
+    start();
+
+    sim_setting(Setting_LaserCoolantOptions, "2"); // Feed hold on coolant fault
+
+    coolant(true);
+    sim.state = STATE_CYCLE;
+    sim_din(OK_PORT, false);
+    CHECK(sim.exec_flags & EXEC_FEED_HOLD);
+
+    sim.state = STATE_IDLE;
+    sim.exec_flags = 0;
+    sim_advance(1000);
+
+    sim.state = STATE_CYCLE;
+    sim_advance(20);
+    CHECK(sim.exec_flags & EXEC_FEED_HOLD);
+    CHECK(sim.alarm == 0);
+}
+
+// The on delay is skipped if the coolant ok input was seen high while coolant was on within the warm time.
+static void test_warm_start (void)
+{
+    start();
+
+    sim_setting(Setting_LaserCoolantWarmTime, "60");
+
+    // Coolant on and off without the ok input going high is not a warm loop.
+    sim_din(OK_PORT, false);
+    coolant(true);
+    sim_advance(1000);
+    coolant(false);
+    sim_setting(Setting_LaserCoolantOnDelay, "2.0");
+    coolant(true);
+    CHECK(sim.alarm == Alarm_AbortCycle);
+
+    sim.alarm = 0;
+    sim_din(OK_PORT, true);
+    coolant(true);
+    sim_advance(1000);
+    coolant(false);
+
+    // Not held by the on delay, verified when it has expired.
+    sim_din(OK_PORT, false);
+    sim_advance(10000);
+    coolant(true);
+    CHECK(sim.alarm == 0);
+    sim_advance(2100);
+    CHECK(sim.alarm == Alarm_AbortCycle);
+}
+
+// The coolant ok input interrupt is claimed when settings are loaded, failure is reported.
+static void test_no_irq (void)
+{
+    laser_coolant_init();
+    sim.irq_caps = IRQ_Mode_Rising;
+    sim_start();
+    sim_advance(1);
+
+    CHECK(strstr(sim.messages, "Laser coolant ok input does not support interrupts!") != NULL);
+}
+
+// Flow meter pulses, 15 per second is 2 l/min with the default 450 pulses/l.
+static void flow_run (uint32_t ms, uint32_t pps)
+{
+    uint32_t t;
+
+    for(t = 0; t < ms; t++) {
+        if(pps && (t % (1000 / pps)) == 0) {
+            sim_din(OK_PORT, true);
+            sim_din(OK_PORT, false);
+        }
+        sim_advance(1);
+    }
+}
+
+static void test_flow (void)
+{
+    laser_coolant_init();
+    sim_setting(Setting_LaserCoolantOptions, "16"); // Flow meter input, requires a reboot
+    sim_start();
+    inputs();
+
+    sim_din(OK_PORT, false);
+    flow_run(2000, 0);
+
+    // Not checked until the flow rate is averaged over samples taken after M8.
+    coolant(true);
+    flow_run(3000, 30);
+    CHECK(sim.state != STATE_ALARM);
+
+    // Fault when the flow stops.
+    flow_run(1500, 0);
+    CHECK(sim.alarm == Alarm_AbortCycle);
+}
+
+#if LASER_COOLANT_ZONES > 1
+
+// Zone 1 temperature on analog input 0, tube temperature is not monitored.
+static void test_zone_temp (void)
+{
+    laser_coolant_init();
+    sim_setting(Setting_LaserCoolantOkPort, "3");
+    sim_setting(Setting_LaserCoolantTempPort, "3");
+    sim_setting(ZONE_SETTING_ID(1, 0), "2"); // Temperature input
+    sim_setting(ZONE_SETTING_ID(1, 2), "0");
+    sim_setting(ZONE_SETTING_ID(1, 4), "40.0");
+    sim_start();
+    inputs();
+
+    sim.ain[0] = 450;
+    sim_advance(500);
+    CHECK(sim.state != STATE_ALARM);
+
+    coolant(true);
+    sim_advance(500);
+    CHECK(sim.alarm == Alarm_AbortCycle);
+}
+
+// Zone 1 coolant ok on digital input 1, low before coolant is turned on.
+static void zone_ok_start (void)
+{
+    laser_coolant_init();
+    sim_setting(Setting_LaserCoolantOkPort, "3");
+    sim_setting(Setting_LaserCoolantTempPort, "3");
+    sim_setting(ZONE_SETTING_ID(1, 0), "1"); // Coolant ok input
+    sim_setting(ZONE_SETTING_ID(1, 1), "1");
+    sim_start();
+    inputs();
+
+    sim_din(1, false);
+    sim_advance(1000);
+}
+
+static void test_zone_ok_low (void)
+{
+    zone_ok_start();
+
+    coolant(true);
+    sim_advance(1000);
+    CHECK(sim.alarm == Alarm_AbortCycle);
+}
+
+static void test_zone_ok_on_delay (void)
+{
+    zone_ok_start();
+
+    sim_setting(Setting_LaserCoolantOnDelay, "1.0");
+
+    coolant(true);
+    CHECK(sim.alarm == Alarm_AbortCycle);
+}
+
+#endif
+
+int main (int argc, char **argv)
+{
+    sim_test("derate", test_derate);
+    sim_test("derate after 3 h idle", test_derate_idle_3h);
+    sim_test("derate after 6 h idle", test_derate_idle_6h);
+    sim_test("derate user override", test_derate_user_override);
+    sim_test("derate program end", test_derate_program_end);
+    sim_test("derate reset", test_derate_reset);
+    sim_test("fault hold", test_fault_hold);
+    sim_test("fault while idle", test_fault_idle);
+    sim_test("fault latched", test_fault_latched);
+    sim_test("warm start", test_warm_start);
+    sim_test("flow meter", test_flow);
+    sim_test("no interrupt support", test_no_irq);
+#if LASER_COOLANT_ZONES > 1
+    sim_test("zone temperature", test_zone_temp);
+    sim_test("zone not ok at M8", test_zone_ok_low);
+    sim_test("zone not ok after on delay", test_zone_ok_on_delay);
+#endif
+
+    return sim_done();
+}
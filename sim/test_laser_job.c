@@ -0,0 +1,122 @@
+/*
+
+  test_laser_job.c - host tests for the laser job summary
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// The executing block is sampled every 10 ms, the block is set up to lase at 600 mm/min
+// with 1200 mm/min programmed.
+
+#include <string.h>
+
+#include "driver.h"
+#include "sim.h"
+#include "laser_job.h"
+
+static plan_block_t block;
+
+static void start (void)
+{
+    laser_job_init();
+    sim_start();
+    sim_log_clear();
+
+    block.spindle.state.on = On;
+    block.spindle.rpm = 500.0f;
+    block.programmed_rate = 1200.0f;
+    sim.block = &block;
+    sim.realtime_rate = 600.0f;
+}
+
+static void laser (bool on)
+{
+    grbl.on_spindle_programmed(&sim.spindle, (spindle_state_t){ .on = on }, on ? 500.0f : 0.0f, SpindleSpeedMode_RPM);
+}
+
+static void test_summary (void)
+{
+    start();
+
+    laser(true);
+    sim.state = STATE_CYCLE;
+    sim_advance(1000);
+
+    // Rapids are not lased.
+    block.condition.rapid_motion = On;
+    sim_advance(200);
+
+    // Waiting for the sender is reported as idle time.
+    sim.state = STATE_IDLE;
+    sim_advance(500);
+
+    sim_execute("M2");
+    CHECK_STR(sim.messages, "Laser job: time 1.7 s, laser on 1.0 s, lased 10.0 mm, feed 600/1200 mm/min, idle 0.5 s");
+
+    // Not reported again until the laser is turned on.
+    sim_log_clear();
+    sim_execute("M2");
+    CHECK_STR(sim.messages, "");
+}
+
+// A job is started by turning the laser on, time before that is not counted.
+static void test_start (void)
+{
+    start();
+
+    laser(false);
+    sim_advance(1000);
+    CHECK(sim.ms == 1000);
+
+    laser(true);
+    sim.state = STATE_IDLE;
+    sim_advance(300);
+
+    sim_execute("M30");
+    CHECK_STR(sim.messages, "Laser job: time 0.3 s, laser on 0.0 s, lased 0.0 mm, idle 0.3 s");
+}
+
+// A job aborted by reset is not reported, the next job starts out fresh.
+static void test_reset (void)
+{
+    start();
+
+    laser(true);
+    sim.state = STATE_CYCLE;
+    sim_advance(1000);
+
+    sim_reset();
+    sim.state = STATE_IDLE;
+    sim_execute("M2");
+    CHECK_STR(sim.messages, "");
+
+    laser(true);
+    sim_advance(200);
+    sim_execute("M2");
+    CHECK_STR(sim.messages, "Laser job: time 0.2 s, laser on 0.0 s, lased 0.0 mm, idle 0.2 s");
+}
+
+int main (int argc, char **argv)
+{
+    sim_test("summary", test_summary);
+    sim_test("job start", test_start);
+    sim_test("reset", test_reset);
+
+    return sim_done();
+}
@@ -0,0 +1,175 @@
+/*
+
+  test_laser_telemetry.c - host tests for the laser telemetry frames
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <string.h>
+
+#include "driver.h"
+#include "sim.h"
+#include "laser_telemetry.h"
+
+#define FRAME_LENGTH 31
+
+static laser_telemetry_sample_ptr on_sample;
+
+// Sample data as added by the other plugins.
+static void onSample (laser_telemetry_t *data)
+{
+    data->flags.coolant_temp = data->flags.coolant_flow = data->flags.coolant_on = On;
+    data->coolant_temp = -12.5f;
+    data->coolant_flow = 2.5f;
+    data->ppi_mode = 1;
+    data->pwm = 0x1234;
+    data->ppi_pulses = 0x01020304;
+    data->clusters = 0x05060708;
+    data->decoder_queue = 300;
+
+    if(on_sample)
+        on_sample(data);
+}
+
+static void start (void)
+{
+    laser_telemetry_init();
+    sim_start();
+    sim_log_clear();
+}
+
+static status_code_t command (const char *args)
+{
+    char buf[16];
+
+    strcpy(buf, args);
+
+    return sim_command("LTM", buf);
+}
+
+static uint16_t get_u16 (const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_u32 (const uint8_t *p)
+{
+    return get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+static void test_frame (void)
+{
+    static plan_block_t block = { .spindle.state.on = On, .spindle.rpm = 800.0f };
+
+    uint8_t *frame = sim.output, checksum = 0;
+    uint_fast8_t idx;
+
+    start();
+
+    on_sample = laser_telemetry.on_sample;
+    laser_telemetry.on_sample = onSample;
+
+    sim_advance(0x1234);
+    sim.state = STATE_CYCLE;
+    sim.block = &block;
+
+    CHECK(command("") == Status_OK);
+    CHECK(sim.output_length == FRAME_LENGTH);
+
+    CHECK(frame[0] == LASER_TELEMETRY_SYNC);
+    CHECK(frame[1] == FRAME_LENGTH);
+    CHECK(frame[2] == LASER_TELEMETRY_VERSION);
+    CHECK(frame[3] == 0);
+    CHECK(get_u32(frame + 4) == 0x1234);
+    CHECK(get_u16(frame + 8) == STATE_CYCLE);
+    CHECK(frame[10] == 0b10111); // laser on, coolant temperature, flow and on
+    CHECK(frame[11] == 1);
+    CHECK(get_u16(frame + 12) == 800);
+    CHECK(get_u16(frame + 14) == 0x1234);
+    CHECK((int16_t)get_u16(frame + 16) == -125);
+    CHECK(get_u16(frame + 18) == 250);
+    CHECK(get_u32(frame + 20) == 0x01020304);
+    CHECK(get_u32(frame + 24) == 0x05060708);
+    CHECK(get_u16(frame + 28) == 300);
+
+    for(idx = 1; idx < FRAME_LENGTH - 1; idx++)
+        checksum ^= frame[idx];
+
+    CHECK(frame[30] == checksum);
+
+    // Laser is not on in rapids.
+    sim_log_clear();
+    block.condition.rapid_motion = On;
+    command("");
+    CHECK(frame[3] == 1);
+    CHECK(frame[10] == 0b10110);
+    CHECK(get_u16(frame + 12) == 0);
+}
+
+static void test_rate (void)
+{
+    uint_fast8_t idx;
+
+    start();
+
+    CHECK(command("50") == Status_OK);
+    sim_advance(100);
+    CHECK(sim.output_length == 5 * FRAME_LENGTH);
+
+    for(idx = 0; idx < 5; idx++) {
+        CHECK(sim.output[idx * FRAME_LENGTH] == LASER_TELEMETRY_SYNC);
+        CHECK(sim.output[idx * FRAME_LENGTH + 3] == idx);
+        CHECK(get_u32(sim.output + idx * FRAME_LENGTH + 4) == 20 * (idx + 1));
+    }
+
+    // Running a file from the stream does not stop telemetry.
+    sim_log_clear();
+    sim_file_open((const uint8_t *)"", 0);
+    sim_advance(20);
+    sim_file_close();
+    CHECK(sim.output_length == FRAME_LENGTH);
+
+    sim_log_clear();
+    CHECK(command("0") == Status_OK);
+    sim_advance(100);
+    CHECK(sim.output_length == 0);
+}
+
+static void test_rate_invalid (void)
+{
+    start();
+
+    CHECK(command("x") == Status_BadNumberFormat);
+    CHECK(command("10x") == Status_BadNumberFormat);
+    CHECK(command("-1") == Status_InvalidStatement);
+    CHECK(command("2.5") == Status_InvalidStatement);
+    CHECK(command("101") == Status_InvalidStatement);
+
+    sim_advance(100);
+    CHECK(sim.output_length == 0);
+}
+
+int main (int argc, char **argv)
+{
+    sim_test("frame layout", test_frame);
+    sim_test("push rate", test_rate);
+    sim_test("invalid rate", test_rate_invalid);
+
+    return sim_done();
+}
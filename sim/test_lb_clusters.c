@@ -0,0 +1,424 @@
+/*
+
+  test_lb_clusters.c - host tests for the LightBurn cluster decoder
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Built once for each set of decoder options, checks that do not apply to the
+// options of the current build are left out.
+
+#include <string.h>
+#include <unistd.h>
+
+#include "driver.h"
+#include "sim.h"
+
+#ifndef LB_CLUSTERS_THREADED
+#define LB_CLUSTERS_THREADED 0
+#endif
+#ifndef LB_BLANK_COLLAPSE
+#define LB_BLANK_COLLAPSE 0
+#endif
+#ifndef LB_COMPRESSED_FILES
+#define LB_COMPRESSED_FILES 0
+#endif
+#ifndef LB_HS_WINDOW_BITS
+#define LB_HS_WINDOW_BITS 8
+#endif
+#ifndef LB_HS_LOOKAHEAD_BITS
+#define LB_HS_LOOKAHEAD_BITS 4
+#endif
+#ifndef LB_REPLAY_BUFFER
+#define LB_REPLAY_BUFFER 0
+#endif
+
+void lb_clusters_init (void);
+
+static const char *fail_line = NULL;
+
+static void start (void)
+{
+    lb_clusters_init();
+    sim_start();
+    sim.threaded = LB_CLUSTERS_THREADED;
+}
+
+static status_code_t execute (char *line)
+{
+    return fail_line && !strcmp(line, fail_line) ? Status_GcodeNoAxisWords : sim_execute(line);
+}
+
+// Runs input through the serial stream decoder.
+static void run (const char *data)
+{
+    sim_log_clear();
+    sim_input(data);
+    sim_run(execute);
+
+    // Driver stream functions must only be called from the core.
+    CHECK(!sim.foreign_read);
+}
+
+// Runs input through the file stream decoder.
+static void run_file (const uint8_t *data, size_t length)
+{
+    sim_log_clear();
+    sim_file_open(data, length);
+    sim_run(execute);
+    sim_file_close();
+}
+
+static void test_decode (void)
+{
+    start();
+
+    run("G1X1S10:20:30:40\n");
+    CHECK_STR(sim.lines, "G1X0.25S10|G1X0.25S20|G1X0.25S30|G1X0.25S40");
+    CHECK_STR(sim.status, "ok");
+
+    run("G1 X-0.5 F3000 S10:20\n");
+    CHECK_STR(sim.lines, "G1X-0.25S10F3000|G1X-0.25S20");
+    CHECK_STR(sim.status, "ok");
+}
+
+static void test_modal (void)
+{
+    start();
+
+    run("G1X0.5S1:2\nY0.5S3:4\nG0X10\nX0.5S5:6\n");
+    CHECK_STR(sim.lines, "G1X0.25S1|G1X0.25S2|G1Y0.25S3|G1Y0.25S4|G0X10|X0.5S5:6");
+    CHECK_STR(sim.status, "ok ok ok ok");
+
+    // System commands do not change modal state.
+    run("G0X1\n$J=G1X1F1000\nX0.5S1:2\n");
+    CHECK_STR(sim.lines, "G0X1|$J=G1X1F1000|X0.5S1:2");
+
+    // Only fractional G-codes that are motion modes change the motion mode.
+    run("G1X0.5S1:2\nG91.1\nX0.5S3:4\nG38.2Z-1F100\nX0.5S5:6\n");
+    CHECK_STR(sim.lines, "G1X0.25S1|G1X0.25S2|G91.1|G1X0.25S3|G1X0.25S4|G38.2Z-1F100|X0.5S5:6");
+}
+
+static void test_passthru (void)
+{
+    start();
+
+    run("G0X10Y10\nM3S100\n(G1X1S1:2)\n$J=G91X1F1000\nG1X0.5S1:2 (cluster)\n");
+    CHECK_STR(sim.lines, "G0X10Y10|M3S100|(G1X1S1:2)|$J=G91X1F1000|G1X0.25S1|G1X0.25S2 (cluster)");
+    CHECK_STR(sim.status, "ok ok ok ok ok");
+}
+
+static void test_error (void)
+{
+    start();
+
+    fail_line = "G1X0.25S2";
+    run("G1X0.75S1:2:3\nG0X0\n");
+    CHECK_STR(sim.lines, "G1X0.25S1|G1X0.25S2|G0X0");
+    CHECK_STR(sim.status, "error:31 ok");
+}
+
+static void test_file (void)
+{
+    static const char file[] = "G1X1S10:20:30:40\nG0X0\nG1X0.5S1:2";
+
+    start();
+
+    run_file((const uint8_t *)file, strlen(file));
+    CHECK_STR(sim.lines, "G1X0.25S10|G1X0.25S20|G1X0.25S30|G1X0.25S40|G0X0|G1X0.25S1|G1X0.25S2");
+    CHECK_STR(sim.status, "ok ok ok");
+
+    run("G1X0.5S3:4\n");
+    CHECK_STR(sim.lines, "G1X0.25S3|G1X0.25S4");
+
+    // Last line is terminated when passed through as well.
+    run_file((const uint8_t *)"G0X0\nM2", 7);
+    CHECK_STR(sim.lines, "G0X0|M2");
+    CHECK_STR(sim.status, "ok ok");
+}
+
+static void test_reset (void)
+{
+    start();
+
+    // Incomplete line is discarded on reset, modal state is cleared.
+    run("G1X0.5S1:2\nG1X0.5S1");
+    sim_reset();
+    run("X0.5S3:4\n");
+    CHECK_STR(sim.lines, "X0.5S3:4");
+    CHECK_STR(sim.status, "ok");
+}
+
+#if LB_CLUSTERS_THREADED
+
+static on_reset_ptr on_reset;
+
+// Input received while the core handles the reset, flushed when it completes.
+static void input_on_reset (void)
+{
+    on_reset();
+
+    sim_input("G1X0.5S1:2\n");
+    usleep(20000);
+}
+
+static void test_threaded_reset (void)
+{
+    start();
+
+    on_reset = grbl.on_reset;
+    grbl.on_reset = input_on_reset;
+
+    run("G1X0.5S1:2\n");
+    sim_reset();
+    run("X0.5S3:4\n");
+    CHECK_STR(sim.lines, "X0.5S3:4");
+    CHECK_STR(sim.status, "ok");
+}
+
+#endif
+
+#if LB_BLANK_COLLAPSE && !defined(LB_SCAN_SHIFT)
+
+static void test_blank (void)
+{
+    start();
+
+    run("G91\nG1X0.75F3000S10:20:30\nG1X0.75S0:0:0\nG0Y0.25\nG1X-0.75S0:0:0\nG1X-0.75S40:50:60\n");
+    CHECK_STR(sim.lines, "G91|G1X0.25S10F3000|G1X0.25S20|G1X0.25S30|G0Y0.25000S0|G1F3000|G1X-0.25S40|G1X-0.25S50|G1X-0.25S60");
+    CHECK_STR(sim.status, "ok ok ok ok ok ok");
+
+    // Collapsed move is output when the input runs dry.
+    run("G1X0.75S0:0:0\n");
+    CHECK_STR(sim.lines, "G0X0.75000S0|G1F3000");
+    CHECK_STR(sim.status, "ok");
+
+    // Laser is off for a plain move ending the sequence.
+    run("G1X0.75S10:20:30\nG1X-0.75S0:0:0\nG1Y0.25F2000\n");
+    CHECK_STR(sim.lines, "G1X0.25S10|G1X0.25S20|G1X0.25S30|G0X-0.75000S0|G1F3000|G1Y0.25F2000");
+    CHECK_STR(sim.status, "ok ok ok");
+
+    // Modal state is restored from before the line ending the sequence.
+    run("G1X0.75S0:0:0\nG2X1Y1I1\n");
+    CHECK_STR(sim.lines, "G0X0.75000S0|G1F2000|G2X1Y1I1");
+    CHECK_STR(sim.status, "ok ok");
+
+    // Only in relative mode.
+    run("G1\nG90\nG1X0.75S0:0:0\n");
+    CHECK_STR(sim.lines, "G1|G90|G1X0.25S0|G1X0.25S0|G1X0.25S0");
+}
+
+#endif
+
+#ifdef LB_SCAN_SHIFT
+
+// Built with a shift of 1.5 pixels for 0.25 mm pixels.
+
+static void test_shift (void)
+{
+    start();
+
+    // Shift is carried over lines in the same direction and completed when the direction changes.
+    run("G91\nG1X1F3000S10:20:30:40\nG1X1S50:60:70:80\nG1X-1S1:2:3:4\nG0Y1\n");
+    CHECK_STR(sim.lines, "G91|G1X0.125S20F3000|G1X0.25S30|G1X0.25S40|G1X0.25S50|G1X0.25S60|G1X0.25S70|G1X0.25S80|"
+                         "G1X0.37500S0|G1X-0.125S2|G1X-0.25S3|G1X-0.25S4|G1X-0.37500S0|G0Y1");
+    CHECK_STR(sim.status, "ok ok ok ok ok");
+
+    // Only in relative mode.
+    run("G90\nG1X1S10:20:30:40\n");
+    CHECK_STR(sim.lines, "G90|G1X0.25S10|G1X0.25S20|G1X0.25S30|G1X0.25S40");
+}
+
+static void test_shift_file (void)
+{
+    static const char file[] = "G91\nG1X1S10:20:30:40\nG1Y1S1:2:3:4\n";
+
+    start();
+
+    // Completed on axis change and at end of file.
+    run_file((const uint8_t *)file, strlen(file));
+    CHECK_STR(sim.lines, "G91|G1X0.125S20|G1X0.25S30|G1X0.25S40|G1X0.37500S0|G1Y0.125S2|G1Y0.25S3|G1Y0.25S4|G1Y0.37500S0");
+    CHECK_STR(sim.status, "ok ok ok");
+}
+
+#if LB_BLANK_COLLAPSE
+
+static void test_shift_blank (void)
+{
+    start();
+
+    // Collapsed move completes the scanline.
+    run("G91\nG1X1S10:20:30:40\nG1X1S0:0:0:0\nG0Y0.25\nG1X-1S0:0:0:0\nG1X-1S40:50:60:70\n");
+    CHECK_STR(sim.lines, "G91|G1X0.125S20|G1X0.25S30|G1X0.25S40|G0X0.37500Y0.25000S0|G1|G1X-0.125S50|G1X-0.25S60|G1X-0.25S70");
+    CHECK_STR(sim.status, "ok ok ok ok ok ok");
+
+    run("M5\n");
+    CHECK_STR(sim.lines, "G1X-0.37500S0|M5");
+    CHECK_STR(sim.status, "ok");
+}
+
+#endif
+
+#endif
+
+#if LB_COMPRESSED_FILES
+
+// Minimal heatshrink encoder, greedy matching.
+
+static struct {
+    uint8_t *out;
+    size_t length;
+    uint32_t bits;
+    uint_fast8_t n_bits;
+} hs;
+
+static void hs_put (uint32_t value, uint_fast8_t n)
+{
+    while(n--) {
+        hs.bits = (hs.bits << 1) | ((value >> n) & 1);
+        if(++hs.n_bits == 8) {
+            hs.out[hs.length++] = (uint8_t)hs.bits;
+            hs.bits = hs.n_bits = 0;
+        }
+    }
+}
+
+static size_t hs_encode (const char *in, uint8_t *out)
+{
+    size_t pos = 0, n = strlen(in), len, best, offset, off;
+
+    hs.out = out;
+    hs.length = hs.bits = hs.n_bits = 0;
+
+    while(pos < n) {
+
+        best = offset = 0;
+
+        for(off = 1; off <= pos && off <= (1 << LB_HS_WINDOW_BITS); off++) {
+            for(len = 0; len < (1 << LB_HS_LOOKAHEAD_BITS) && pos + len < n && in[pos + len - off] == in[pos + len]; len++);
+            if(len > best) {
+                best = len;
+                offset = off;
+            }
+        }
+
+        if(best >= 2) {
+            hs_put(0, 1);
+            hs_put(offset - 1, LB_HS_WINDOW_BITS);
+            hs_put(best - 1, LB_HS_LOOKAHEAD_BITS);
+            pos += best;
+        } else {
+            hs_put(1, 1);
+            hs_put((uint8_t)in[pos++], 8);
+        }
+    }
+
+    if(hs.n_bits)
+        hs_put(0, 8 - hs.n_bits);
+
+    return hs.length;
+}
+
+static void test_compressed (void)
+{
+    static const char plain[] = "G91\nG1X1.6S0:0:0:0:0:0:0:0:10:10:10:10:20:20:20:20\nG1X-1.6S20:20:20:20:10:10:10:10:0:0:0:0:0:0:0:0\nM2\n";
+    static uint8_t compressed[256] = { 0x89, 'H', 'S', (LB_HS_WINDOW_BITS << 4) | LB_HS_LOOKAHEAD_BITS };
+    static uint8_t bom[256] = { 0xEF, 0xBB, 0xBF };
+
+    size_t length = hs_encode(plain, compressed + 4) + 4;
+    char expected[SIM_LOG_SIZE];
+
+    start();
+
+    CHECK(length < strlen(plain));
+
+    run_file((const uint8_t *)plain, strlen(plain));
+    strcpy(expected, sim.lines);
+    CHECK_STR(sim.status, "ok ok ok ok");
+
+    run_file(compressed, length);
+    CHECK_STR(sim.lines, expected);
+    CHECK_STR(sim.status, "ok ok ok ok");
+
+    // A UTF-8 BOM is stripped, the file is not decompressed.
+    strcpy((char *)bom + 3, plain);
+    run_file(bom, strlen(plain) + 3);
+    CHECK_STR(sim.lines, expected);
+    CHECK_STR(sim.status, "ok ok ok ok");
+
+    // Compressed with other window and lookahead sizes, passed through as is.
+    compressed[3] ^= 0x11;
+    run_file(compressed, length);
+    CHECK_STR(sim.messages, "Compressed file window or lookahead size does not match the plugin");
+    CHECK(strcmp(sim.lines, expected));
+}
+
+#endif
+
+#if LB_REPLAY_BUFFER
+
+static void test_replay (void)
+{
+    static const char file[] = "M100P1\nG1X0.5S1:2\nG0X-0.5\nM100P0\nM100P2\nM100P2\nG0X1\n";
+
+    start();
+
+    run_file((const uint8_t *)file, strlen(file));
+    CHECK_STR(sim.lines, "M100P1|G1X0.25S1|G1X0.25S2|G0X-0.5|M100P0|M100P2|G1X0.25S1|G1X0.25S2|G0X-0.5|M100P2|G1X0.25S1|G1X0.25S2|G0X-0.5|G0X1");
+    CHECK_STR(sim.status, "ok ok ok ok ok ok ok");
+
+    // Replay is stopped by an error.
+    fail_line = "G1X0.25S2";
+    run_file((const uint8_t *)"M100P2\nG0X1\n", 12);
+    CHECK_STR(sim.lines, "M100P2|G1X0.25S1|G1X0.25S2|G0X1");
+    CHECK_STR(sim.status, "ok error:31 ok");
+}
+
+#endif
+
+int main (int argc, char **argv)
+{
+    sim_test("decode", test_decode);
+    sim_test("modal", test_modal);
+    sim_test("passthru", test_passthru);
+    sim_test("error", test_error);
+    sim_test("file", test_file);
+    sim_test("reset", test_reset);
+#if LB_CLUSTERS_THREADED
+    sim_test("threaded reset", test_threaded_reset);
+#endif
+#if LB_BLANK_COLLAPSE && !defined(LB_SCAN_SHIFT)
+    sim_test("blank collapse", test_blank);
+#endif
+#ifdef LB_SCAN_SHIFT
+    sim_test("scan shift", test_shift);
+    sim_test("scan shift file", test_shift_file);
+#if LB_BLANK_COLLAPSE
+    sim_test("scan shift blank collapse", test_shift_blank);
+#endif
+#endif
+#if LB_COMPRESSED_FILES
+    sim_test("compressed file", test_compressed);
+#endif
+#if LB_REPLAY_BUFFER
+    sim_test("replay", test_replay);
+#endif
+
+    return sim_done();
+}
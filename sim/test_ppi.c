@@ -0,0 +1,104 @@
+/*
+
+  test_ppi.c - host tests for the laser PPI plugin
+
+  Part of grblHAL
+
+  Copyright (c) 2026 agent
+
+  grblHAL is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  grblHAL is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with grblHAL. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// The simulated laser has max PWM 1000 and max RPM 1000, steps are 0.01 mm.
+// PPI is set to 254 for 0.1 mm pixels.
+
+#include "driver.h"
+#include "sim.h"
+
+void ppi_init (void);
+
+static void start (const char *mode)
+{
+    ppi_init();
+    sim_start();
+    sim_spindle_select();
+
+    CHECK(sim_execute("M127P254") == Status_OK);
+    CHECK(sim_execute((char *)mode) == Status_OK);
+}
+
+// Steps the given distance in mm at 1000 mm/min, returns the number of pulses fired.
+static uint32_t step (float distance)
+{
+    return sim_step(distance, 1000.0f);
+}
+
+static void test_ppi (void)
+{
+    start("M126P1");
+
+    // PWM follows power.
+    sim.spindle.update_pwm(&sim.spindle, 500);
+    CHECK(sim.pwm_value == 500);
+    CHECK(step(1.0f) == 10);
+    CHECK(sim.pulse_length == 1500);
+}
+
+static void test_dot (void)
+{
+    start("M126P2");
+
+    // Power sets the pulse length, PWM is at max.
+    sim.spindle.update_pwm(&sim.spindle, 250);
+    CHECK(sim.pwm_value == 1000);
+    CHECK(step(1.0f) == 10);
+    CHECK(sim.pulse_length == 375);
+
+    sim.spindle.update_rpm(&sim.spindle, 500.0f);
+    CHECK(sim.rpm == 1000.0f);
+    CHECK(step(1.0f) == 10);
+    CHECK(sim.pulse_length == 750);
+
+    sim.spindle.update_pwm(&sim.spindle, 0);
+    CHECK(sim.pwm_value == 0);
+}
+
+static void test_density (void)
+{
+    uint32_t pulses;
+
+    start("M126P3");
+
+    // Power sets the pulse rate, PWM is at max. The rate is rounded down.
+    sim.spindle.update_pwm(&sim.spindle, 500);
+    CHECK(sim.pwm_value == 1000);
+    pulses = step(2.0f);
+    CHECK(pulses >= 9 && pulses <= 10);
+    CHECK(sim.pulse_length == 1500);
+
+    sim.spindle.set_state(&sim.spindle, (spindle_state_t){ .on = On }, 250.0f);
+    CHECK(sim.rpm == 1000.0f);
+    pulses = step(4.0f);
+    CHECK(pulses >= 9 && pulses <= 10);
+}
+
+int main (int argc, char **argv)
+{
+    sim_test("ppi", test_ppi);
+    sim_test("dot", test_dot);
+    sim_test("density", test_density);
+
+    return sim_done();
+}